@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bup_writer.h"
+
+#include <nv_bup_format.h>
+
+#include <lz4frame.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <string.h>
+#include <zstd.h>
+
+#define BUP_HEADER_HEX 0x00010000
+#define BUP_ZSTD_LEVEL 19
+
+static bool Compress(const std::vector<char>& data, BupCompression compression,
+                     std::vector<char>* out) {
+    if (compression == kBupZstd) {
+        out->resize(ZSTD_compressBound(data.size()));
+        size_t ret = ZSTD_compress(out->data(), out->size(), data.data(),
+                                   data.size(), BUP_ZSTD_LEVEL);
+        if (ZSTD_isError(ret)) {
+            fprintf(stderr, "zstd: %s\n", ZSTD_getErrorName(ret));
+            return false;
+        }
+        out->resize(ret);
+    } else if (compression == kBupLz4) {
+        LZ4F_preferences_t prefs;
+
+        // The updater needs the content size to find the uncompressed length
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.contentSize = data.size();
+        prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+
+        out->resize(LZ4F_compressFrameBound(data.size(), &prefs));
+        size_t ret = LZ4F_compressFrame(out->data(), out->size(), data.data(),
+                                        data.size(), &prefs);
+        if (LZ4F_isError(ret)) {
+            fprintf(stderr, "lz4: %s\n", LZ4F_getErrorName(ret));
+            return false;
+        }
+        out->resize(ret);
+    } else {
+        *out = data;
+    }
+
+    return true;
+}
+
+static void Put32(std::vector<char>* blob, size_t offset, uint32_t value) {
+    memcpy(blob->data() + offset, &value, sizeof(value));
+}
+
+bool BuildBup(const std::vector<BupEntrySpec>& entries,
+              const BupOptions& options, std::vector<char>* blob) {
+    size_t spec_len = options.version == 3 ? IMG_SPEC_INFO_LENGTH_V3
+                                           : IMG_SPEC_INFO_LENGTH_V2;
+    size_t entry_len = ENTRY_LEN_WO_SPEC + spec_len;
+    size_t header_size = HEADER_LEN_WO_RATCHET +
+        (options.type == UPDATE_TYPE ? RATCHET_INFO_LEN : 0);
+    size_t table_end = header_size + entries.size() * entry_len;
+    uint64_t uncomp_size = table_end;
+    std::vector<char> payload;
+
+    blob->assign(table_end, 0);
+
+    for (size_t i = 0; i < entries.size(); i++) {
+        const BupEntrySpec& entry = entries[i];
+        size_t offset = header_size + i * entry_len;
+        size_t pos = blob->size();
+
+        if (entry.partition.size() >= PARTITION_LEN ||
+            entry.spec.size() >= spec_len) {
+            fprintf(stderr, "Entry %zu: partition or spec name too long\n", i);
+            return false;
+        }
+
+        if (!Compress(entry.data, options.compression, &payload))
+            return false;
+
+        blob->insert(blob->end(), payload.begin(), payload.end());
+        uncomp_size += entry.data.size();
+        if (blob->size() > UINT32_MAX || uncomp_size > UINT32_MAX) {
+            fprintf(stderr, "Payload does not fit in 4 GiB\n");
+            return false;
+        }
+
+        memcpy(blob->data() + offset, entry.partition.data(),
+               entry.partition.size());
+        offset += PARTITION_LEN;
+        Put32(blob, offset, pos);
+        Put32(blob, offset + 4, payload.size());
+        Put32(blob, offset + 8, entry.version);
+        Put32(blob, offset + 12, entry.op_mode);
+        memcpy(blob->data() + offset + 16, entry.spec.data(), entry.spec.size());
+    }
+
+    memcpy(blob->data(), options.version == 3 ? UPDATE_MAGIC_V3
+                                              : UPDATE_MAGIC_V2,
+           UPDATE_MAGIC_SIZE - 1);
+    Put32(blob, UPDATE_MAGIC_SIZE - 1, BUP_HEADER_HEX);
+    Put32(blob, UPDATE_MAGIC_SIZE + 3, blob->size());
+    Put32(blob, UPDATE_MAGIC_SIZE + 7, header_size);
+    Put32(blob, UPDATE_MAGIC_SIZE + 11, entries.size());
+    Put32(blob, UPDATE_MAGIC_SIZE + 15, options.type);
+    // Raw blobs leave this 0, which tells the updater not to probe entries
+    Put32(blob, UPDATE_MAGIC_SIZE + 19,
+          options.compression == kBupRaw ? 0 : uncomp_size);
+
+    if (options.manifest) {
+        uint32_t count = entries.size();
+        size_t offset = blob->size();
+
+        blob->resize(offset + DIGEST_MAGIC_SIZE + sizeof(count) +
+                     entries.size() * SHA256_DIGEST_LENGTH);
+        memcpy(blob->data() + offset, DIGEST_MAGIC, DIGEST_MAGIC_SIZE);
+        Put32(blob, offset + DIGEST_MAGIC_SIZE, count);
+        offset += DIGEST_MAGIC_SIZE + sizeof(count);
+
+        for (const BupEntrySpec& entry : entries) {
+            SHA256((const uint8_t*) entry.data.data(), entry.data.size(),
+                   (uint8_t*) blob->data() + offset);
+            offset += SHA256_DIGEST_LENGTH;
+        }
+    }
+
+    return true;
+}
+
+bool WriteBup(const std::string& path,
+              const std::vector<BupEntrySpec>& entries,
+              const BupOptions& options) {
+    std::vector<char> blob;
+
+    if (!BuildBup(entries, options, &blob))
+        return false;
+
+    FILE* out = fopen(path.c_str(), "w");
+    if (!out) {
+        perror(path.c_str());
+        return false;
+    }
+
+    bool ok = fwrite(blob.data(), 1, blob.size(), out) == blob.size();
+    if (fclose(out) || !ok) {
+        perror(path.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+const char* BupCompressionName(BupCompression compression) {
+    switch (compression) {
+    case kBupZstd:
+        return "zstd";
+    case kBupLz4:
+        return "lz4";
+    default:
+        return "none";
+    }
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_BUP_WRITER_H_
+#define NV_BUP_WRITER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+enum BupCompression {
+    kBupRaw = 0,
+    kBupZstd,
+    kBupLz4
+};
+
+struct BupEntrySpec {
+    std::string partition;
+    std::string spec;           // tnspec the entry applies to, empty for any
+    uint32_t op_mode = 0;       // 0 for any, 1 or 2 for a fuse mode
+    uint32_t version = 1;
+    std::vector<char> data;     // uncompressed payload
+};
+
+struct BupOptions {
+    int version = 2;            // entry table layout, 2 or 3
+    uint32_t type = 0;          // UPDATE_TYPE or BMP_TYPE
+    BupCompression compression = kBupRaw;
+    bool manifest = false;      // append the SHA-256 digest manifest
+};
+
+/*
+ * Builds a bootloader update payload in the layout the payload updater
+ * parses. Entries are compressed as whole frames carrying their content
+ * size. Returns false if an entry does not fit the format.
+ */
+bool BuildBup(const std::vector<BupEntrySpec>& entries,
+              const BupOptions& options, std::vector<char>* blob);
+
+// Builds the payload and writes it to path
+bool WriteBup(const std::string& path,
+              const std::vector<BupEntrySpec>& entries,
+              const BupOptions& options);
+
+const char* BupCompressionName(BupCompression compression);
+
+#endif  // NV_BUP_WRITER_H_
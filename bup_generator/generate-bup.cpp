@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Generates synthetic bootloader update payloads for exercising
+ * nv_bootloader_payload_updater on the host.
+ */
+
+#include "bup_writer.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#define DEFAULT_ENTRIES 4
+#define DEFAULT_ENTRY_SIZE (64 * 1024)
+#define DEPEND_BCT_SIZE 8192
+#define DEPEND_MB1_SIZE (256 * 1024)
+
+static void Usage(const char* prog) {
+    printf("Usage: %s [options] <out_file>\n"
+           "  -v <2|3>          blob version (default 2)\n"
+           "  -n <count>        number of entries (default %d)\n"
+           "  -s <size>         entry size, or <min>:<max> for random sizes\n"
+           "                    (default %d)\n"
+           "  -t <spec,...>     tnspecs to cycle through, \"-\" for any\n"
+           "  -o <mode,...>     op_modes to cycle through, 0 for any\n"
+           "  -d                add BCT and mb1 entries\n"
+           "  -c <none|zstd|lz4> entry compression (default none)\n"
+           "  -z <percent>      zero-filled tail of each entry\n"
+           "  -m                append the SHA-256 digest manifest\n"
+           "  -p <prefix>       partition name prefix (default bootfw)\n"
+           "  -r <seed>         random seed (default 1)\n",
+           prog, DEFAULT_ENTRIES, DEFAULT_ENTRY_SIZE);
+}
+
+static std::vector<std::string> Split(const char* list) {
+    std::vector<std::string> items;
+    std::string item;
+
+    for (const char* c = list; ; c++) {
+        if (*c == ',' || !*c) {
+            items.push_back(item == "-" ? "" : item);
+            item.clear();
+            if (!*c)
+                break;
+        } else {
+            item += *c;
+        }
+    }
+
+    return items;
+}
+
+static uint32_t Random(uint32_t* seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+static std::vector<char> Pattern(size_t size, unsigned zero_percent,
+                                 uint32_t* seed) {
+    std::vector<char> data(size, 0);
+    size_t random = size - size * zero_percent / 100;
+
+    for (size_t i = 0; i < random; i++)
+        data[i] = Random(seed);
+
+    return data;
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> specs(1);
+    std::vector<uint32_t> op_modes(1, 0);
+    std::vector<BupEntrySpec> entries;
+    std::string prefix = "bootfw";
+    BupOptions options;
+    unsigned count = DEFAULT_ENTRIES, zero_percent = 0;
+    unsigned long min_size = DEFAULT_ENTRY_SIZE, max_size = DEFAULT_ENTRY_SIZE;
+    uint32_t seed = 1;
+    bool depend = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "v:n:s:t:o:dc:z:mp:r:h")) != -1) {
+        switch (opt) {
+        case 'v':
+            options.version = atoi(optarg);
+            break;
+        case 'n':
+            count = strtoul(optarg, nullptr, 0);
+            break;
+        case 's':
+            if (sscanf(optarg, "%lu:%lu", &min_size, &max_size) == 1)
+                max_size = min_size;
+            break;
+        case 't':
+            specs = Split(optarg);
+            break;
+        case 'o':
+            op_modes.clear();
+            for (const std::string& mode : Split(optarg))
+                op_modes.push_back(strtoul(mode.c_str(), nullptr, 0));
+            break;
+        case 'd':
+            depend = true;
+            break;
+        case 'c':
+            if (!strcmp(optarg, "zstd")) {
+                options.compression = kBupZstd;
+            } else if (!strcmp(optarg, "lz4")) {
+                options.compression = kBupLz4;
+            } else if (strcmp(optarg, "none")) {
+                Usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'z':
+            zero_percent = strtoul(optarg, nullptr, 0);
+            break;
+        case 'm':
+            options.manifest = true;
+            break;
+        case 'p':
+            prefix = optarg;
+            break;
+        case 'r':
+            seed = strtoul(optarg, nullptr, 0);
+            break;
+        default:
+            Usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (optind != argc - 1 || (options.version != 2 && options.version != 3) ||
+        !min_size || min_size > max_size || zero_percent > 100) {
+        Usage(argv[0]);
+        return -1;
+    }
+
+    if (depend) {
+        BupEntrySpec bct, mb1;
+
+        bct.partition = "BCT";
+        bct.data = Pattern(DEPEND_BCT_SIZE, zero_percent, &seed);
+        mb1.partition = "mb1";
+        mb1.data = Pattern(DEPEND_MB1_SIZE, zero_percent, &seed);
+        entries.push_back(bct);
+        entries.push_back(mb1);
+    }
+
+    for (unsigned i = 0; i < count; i++) {
+        BupEntrySpec entry;
+        uint32_t pick = Random(&seed) << 16 | Random(&seed);
+        size_t size = min_size + pick % (max_size - min_size + 1);
+
+        /*
+         * Every spec and op_mode combination gets its own copy of a
+         * partition, like a blob built for several boards.
+         */
+        entry.partition = prefix + std::to_string(i / (specs.size() * op_modes.size()));
+        entry.spec = specs[i % specs.size()];
+        entry.op_mode = op_modes[(i / specs.size()) % op_modes.size()];
+        entry.data = Pattern(size, zero_percent, &seed);
+        entries.push_back(entry);
+    }
+
+    if (!WriteBup(argv[optind], entries, options))
+        return -1;
+
+    printf("Wrote %zu entries (V%d, %s) to %s\n", entries.size(),
+           options.version, BupCompressionName(options.compression),
+           argv[optind]);
+    return 0;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef _NV_BUP_FORMAT_H_
+#define _NV_BUP_FORMAT_H_
+
+/*
+ * Layout of a bootloader update payload (BUP):
+ *   header | entry table | entry payloads [| digest manifest]
+ *
+ * Header: magic (without terminator), then the 32-bit words version,
+ * blob size, header size, entry count, type and uncompressed size, then
+ * the ratchet info for UPDATE_TYPE blobs.
+ *
+ * Entry: partition name[PARTITION_LEN], then the 32-bit words pos, len,
+ * version and op_mode, then the tnspec[IMG_SPEC_INFO_LENGTH_V2/V3].
+ */
+
+#define UPDATE_TYPE 0
+#define BMP_TYPE 1
+
+#define UPDATE_MAGIC_V2 "NVIDIA__BLOB__V2"
+#define UPDATE_MAGIC_V3 "NVIDIA__BLOB__V3"
+#define UPDATE_MAGIC_SIZE 17
+#define ENTRY_LEN_WO_SPEC 56
+#define IMG_SPEC_INFO_LENGTH_V2 64
+#define IMG_SPEC_INFO_LENGTH_V3 128
+#define PARTITION_LEN 40
+#define RATCHET_INFO_LEN 8
+
+/* Header without ratchet info */
+#define HEADER_LEN_WO_RATCHET (UPDATE_MAGIC_SIZE - 1 + 6 * 4)
+
+/*
+ * Optional per-entry SHA-256 digests of the uncompressed payloads, in
+ * entry table order. They follow the blob as a trailer at header->size,
+ * or live in a sidecar file next to it:
+ *   magic[16] | uint32_t count | count * digest[32]
+ */
+#define DIGEST_MAGIC "NVIDIA__SHA256__"
+#define DIGEST_MAGIC_SIZE 16
+#define DIGEST_SIDECAR_SUFFIX ".sha256"
+
+#endif /* _NV_BUP_FORMAT_H_ */
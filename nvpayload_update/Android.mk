@@ -34,13 +34,12 @@ LOCAL_C_INCLUDES := \
     external/gptfdisk \
     $(LOCAL_PATH)/../include
 LOCAL_SRC_FILES := \
-    nv_bootloader_payload_updater.cpp \
-    gpt/gpttegra.cpp
+    nv_bootloader_payload_updater_main.cpp
 LOCAL_CFLAGS := $(common_cflags)
 LOCAL_CFLAGS += -Wno-sign-compare
 LOCAL_CPPFLAGS := $(common_cppflags)
 LOCAL_MODULE_CLASS := EXECUTABLES
-LOCAL_STATIC_LIBRARIES := liblog libbase libext2_uuid libgptf
+LOCAL_STATIC_LIBRARIES := libnv_bootloader_payload_updater liblog libbase libext2_uuid libgptf libzstd liblz4 libcrypto_static libz
 LOCAL_FORCE_STATIC_EXECUTABLE := true
 LOCAL_MODULE := nv_bootloader_payload_updater
 include $(BUILD_EXECUTABLE)
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bct_plan.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include "update_report.h"
+
+/* Round-up n to next multiple of w */
+#define BCT_ROUND_UP(n, w) ((((n) + (w) - 1) / (w)) * (w))
+
+std::vector<BctWrite> PlanBctWrites(const BctGeometry& geo, uint32_t bct_size,
+                                    int slot) {
+    std::vector<BctWrite> plan;
+
+    /*
+    The term "slot" refers to a potential location
+    of a BCT in a block. A slot is the smallest integral
+    number of pages that can hold a BCT.Thus, every
+    BCT begins at the start of a page and may span
+    multiple pages. A block is a space in memory that
+    can hold multiple slots of BCTs.
+
+    The BCT search sequence followed by BootROM is:
+    Block 0, Slot 0
+    Block 0, Slot 1
+    Block 1, Slot 0
+    .....
+    Block 63, Slot N
+    Based on the search sequence, we write the
+    block 0, slot 1 BCT first, followed by one BCT
+    in slot 0 of subsequent blocks and lastly one BCT
+    in block0, slot 0.
+    */
+    uint64_t slot_size = BCT_ROUND_UP(bct_size, geo.page_size);
+    uint64_t block_stride = BCT_ROUND_UP(geo.block_size, geo.lba_size);
+
+    if (!slot) {
+        /*
+         * One BCT goes to slot 1 of block 0 if the block has room for it.
+         * It has to be on the media before slot 0 is touched, so BootROM
+         * always finds a valid copy in block 0.
+         */
+        uint64_t offset = BCT_ROUND_UP(slot_size, geo.lba_size);
+        if (geo.block_size > offset)
+            plan.push_back({ offset, true });
+
+        plan.push_back({ 0, true });
+        return plan;
+    }
+
+    /*
+     * Slot 0 of all other blocks. Their relative order does not matter
+     * to BootROM, so only the last one is a barrier.
+     */
+    for (uint64_t offset = block_stride;
+         offset < geo.part_size && plan.size() < BCT_MAX_COPIES - 1;
+         offset += block_stride)
+        plan.push_back({ offset, false });
+
+    if (!plan.empty())
+        plan.back().barrier = true;
+
+    return plan;
+}
+
+int ExecuteBctPlan(int fd, const std::vector<BctWrite>& plan,
+                   const void* buf, size_t len, uint64_t* sync_us) {
+    uint64_t unused = 0;
+
+    for (const BctWrite& write : plan) {
+        size_t done = 0;
+
+        while (done < len) {
+            ssize_t bytes = pwrite(fd, static_cast<const char*>(buf) + done,
+                                   len - done, write.offset + done);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0) {
+                if (!bytes)
+                    errno = EIO;
+                return -1;
+            }
+            done += bytes;
+        }
+
+        if (write.barrier) {
+            ScopedTimer timer(sync_us ? sync_us : &unused);
+
+            if (fdatasync(fd))
+                return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NV_BCT_PLAN_H_
+#define NV_BCT_PLAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#define BCT_MAX_COPIES 64
+
+struct BctGeometry {
+    uint32_t block_size;    // BootROM block size
+    uint32_t page_size;     // BootROM page size
+    uint32_t lba_size;      // logical block size of the boot device
+    uint64_t part_size;     // size of the BCT partition
+};
+
+struct BctWrite {
+    uint64_t offset;
+    // All writes up to and including this one must be durable before
+    // the next write is issued.
+    bool barrier;
+};
+
+/*
+ * Computes where the copies of a BCT of bct_size bytes go for the given
+ * slot, in the order BootROM needs them to land. Slot 0 owns block 0,
+ * slot 1 owns slot 0 of every later block.
+ */
+std::vector<BctWrite> PlanBctWrites(const BctGeometry& geo, uint32_t bct_size,
+                                    int slot);
+
+/*
+ * Writes buf to every offset of the plan through fd, syncing only at the
+ * barriers. The time spent syncing is added to sync_us unless it is null.
+ * Returns 0 on success, -1 with errno set otherwise.
+ */
+int ExecuteBctPlan(int fd, const std::vector<BctWrite>& plan,
+                   const void* buf, size_t len, uint64_t* sync_us = nullptr);
+
+#endif  // NV_BCT_PLAN_H_
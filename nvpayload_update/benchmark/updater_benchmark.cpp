@@ -0,0 +1,444 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * End-to-end benchmark of the payload updater on the host. Every run
+ * builds a file-backed boot device described by a real GPT, a directory
+ * of by-name user partitions and a synthetic BUP, then times the whole
+ * UpdateDriver flow against them.
+ */
+
+#include "nv_bootloader_payload_updater.h"
+
+#include <bup_writer.h>
+
+#include <android-base/logging.h>
+#include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define LBA_SIZE 512
+#define GPT_ENTRIES 128
+#define GPT_ENTRY_SIZE 128
+#define GPT_TABLE_LBAS (GPT_ENTRIES * GPT_ENTRY_SIZE / LBA_SIZE)
+#define PART_ALIGN (64 * 1024)
+#define BCT_PART_SIZE (1024 * 1024)
+#define BCT_SIZE 8192
+#define MB1_SIZE (256 * 1024)
+// The boot device is an eMMC boot partition, whatever the files are on
+#define EMMC_GEOMETRY "logical_block_size=512\nphysical_block_size=512\n" \
+                      "minimum_io_size=512\noptimal_io_size=0\n"
+
+namespace {
+
+struct __attribute__((packed)) GptHeader {
+    char signature[8];
+    uint32_t revision;
+    uint32_t header_size;
+    uint32_t header_crc;
+    uint32_t reserved;
+    uint64_t current_lba;
+    uint64_t backup_lba;
+    uint64_t first_usable_lba;
+    uint64_t last_usable_lba;
+    uint8_t disk_guid[16];
+    uint64_t entries_lba;
+    uint32_t num_entries;
+    uint32_t entry_size;
+    uint32_t entries_crc;
+};
+
+struct __attribute__((packed)) GptEntry {
+    uint8_t type_guid[16];
+    uint8_t unique_guid[16];
+    uint64_t first_lba;
+    uint64_t last_lba;
+    uint64_t attributes;
+    uint16_t name[36];
+};
+
+struct FakePartition {
+    std::string name;
+    uint64_t offset;
+    uint64_t size;
+};
+
+bool WriteFile(const std::string& path, const void* data, size_t len,
+               uint64_t offset = 0) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && pwrite(fd, data, len, offset) == (ssize_t) len;
+
+    if (fd >= 0)
+        close(fd);
+    return ok;
+}
+
+/*
+ * Writes primary and backup GPT to path. Tegra boot devices keep the BCT
+ * at offset 0 and the updater only uses the backup table, so the usable
+ * range starts at LBA 0 here as well.
+ */
+bool WriteGpt(const std::string& path, uint64_t disk_size,
+              const std::vector<FakePartition>& parts) {
+    std::vector<GptEntry> entries(GPT_ENTRIES);
+    uint64_t last_lba = disk_size / LBA_SIZE - 1;
+    GptHeader header;
+
+    memset(entries.data(), 0, entries.size() * sizeof(GptEntry));
+    for (size_t i = 0; i < parts.size() && i < GPT_ENTRIES; i++) {
+        GptEntry& entry = entries[i];
+
+        memset(entry.type_guid, 0xa5, sizeof(entry.type_guid));
+        memset(entry.unique_guid, (int) i + 1, sizeof(entry.unique_guid));
+        entry.first_lba = parts[i].offset / LBA_SIZE;
+        entry.last_lba = (parts[i].offset + parts[i].size) / LBA_SIZE - 1;
+        for (size_t c = 0; c < parts[i].name.size() && c < 35; c++)
+            entry.name[c] = parts[i].name[c];
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.signature, "EFI PART", 8);
+    header.revision = 0x00010000;
+    header.header_size = sizeof(header);
+    header.first_usable_lba = 0;
+    header.last_usable_lba = last_lba - GPT_TABLE_LBAS - 1;
+    memset(header.disk_guid, 0x5a, sizeof(header.disk_guid));
+    header.num_entries = GPT_ENTRIES;
+    header.entry_size = GPT_ENTRY_SIZE;
+    header.entries_crc = crc32(0, (const Bytef*) entries.data(),
+                               entries.size() * sizeof(GptEntry));
+
+    GptHeader primary = header;
+    primary.current_lba = 1;
+    primary.backup_lba = last_lba;
+    primary.entries_lba = 2;
+    primary.header_crc = crc32(0, (const Bytef*) &primary, sizeof(primary));
+
+    GptHeader backup = header;
+    backup.current_lba = last_lba;
+    backup.backup_lba = 1;
+    backup.entries_lba = last_lba - GPT_TABLE_LBAS;
+    backup.header_crc = crc32(0, (const Bytef*) &backup, sizeof(backup));
+
+    return WriteFile(path, &primary, sizeof(primary), LBA_SIZE) &&
+           WriteFile(path, entries.data(), entries.size() * sizeof(GptEntry),
+                     2 * LBA_SIZE) &&
+           WriteFile(path, entries.data(), entries.size() * sizeof(GptEntry),
+                     backup.entries_lba * LBA_SIZE) &&
+           WriteFile(path, &backup, sizeof(backup), last_lba * LBA_SIZE) &&
+           truncate(path.c_str(), disk_size) == 0;
+}
+
+std::vector<char> ZeroTail(std::vector<char> data, int percent) {
+    size_t zeros = data.size() * percent / 100;
+
+    std::fill(data.end() - zeros, data.end(), 0);
+    return data;
+}
+
+std::vector<char> Pattern(size_t size, uint32_t seed) {
+    std::vector<char> data(size);
+
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = seed >> 16;
+    }
+    return data;
+}
+
+/*
+ * Target slot b of a device with boot_entries boot device partitions and
+ * user_entries by-name partitions of each slot, each entry_size bytes,
+ * plus mb1 and BCT.
+ * Payload entries are stored with the given compression, and the last
+ * zero_percent of each partition image is zero.
+ */
+class FakeDevice {
+ public:
+    FakeDevice(size_t entry_size, int boot_entries, int user_entries,
+               BupCompression compression, int zero_percent = 0) {
+        char dir[] = "/tmp/nvbupbench.XXXXXX";
+        std::vector<FakePartition> parts;
+        std::vector<BupEntrySpec> entries;
+        BupOptions options;
+        uint64_t offset = 0;
+
+        dir_ = mkdtemp(dir);
+        config_.blob_path = dir_ + "/bl_update_payload";
+        config_.bmp_path = dir_ + "/bmp.blob";
+        config_.partition_path = dir_ + "/by-name/";
+        config_.boot_part = dir_ + "/bootdev";
+        config_.gpt_part = dir_ + "/gptdev";
+        config_.journal_path = dir_ + "/journal";
+        config_.verify_journal_path = dir_ + "/verify.journal";
+        config_.geometry_path = dir_ + "/geometry";
+        config_.target_slot = 1;
+        mkdir(config_.partition_path.c_str(), 0755);
+
+        auto add_part = [&](const std::string& name, uint64_t size) {
+            parts.push_back({ name, offset, ROUND_UP(size, PART_ALIGN) });
+            offset += ROUND_UP(size, PART_ALIGN);
+        };
+
+        add_part("BCT", BCT_PART_SIZE);
+        add_part("mb1", MB1_SIZE);
+        add_part("mb1_b", MB1_SIZE);
+        entries.push_back(Entry("BCT", Pattern(BCT_SIZE, 1)));
+        entries.push_back(Entry("mb1", Pattern(MB1_SIZE, 2)));
+
+        for (int i = 0; i < boot_entries; i++) {
+            std::string name = "bootfw" + std::to_string(i);
+
+            add_part(name, entry_size);
+            add_part(name + "_b", entry_size);
+            entries.push_back(Entry(name, ZeroTail(Pattern(entry_size, 10 + i),
+                                                   zero_percent)));
+        }
+
+        for (int i = 0; i < user_entries; i++) {
+            std::string name = "userfw" + std::to_string(i);
+
+            entries.push_back(Entry(name, ZeroTail(Pattern(entry_size, 100 + i),
+                                                   zero_percent)));
+            for (const char* suffix : { "", "_b" }) {
+                std::string path = config_.partition_path + name + suffix;
+
+                truncate_ok_ &= WriteFile(path, "", 0) &&
+                                truncate(path.c_str(), entry_size) == 0;
+            }
+        }
+
+        boot_size_ = offset + (GPT_TABLE_LBAS + 2) * LBA_SIZE;
+        options.compression = compression;
+        for (const BupEntrySpec& entry : entries)
+            payload_bytes_ += entry.data.size();
+
+        ok_ = truncate_ok_ && BuildBup(entries, options, &blob_) &&
+              WriteFile(config_.geometry_path, EMMC_GEOMETRY,
+                        strlen(EMMC_GEOMETRY)) &&
+              WriteGpt(config_.gpt_part, boot_size_, parts) &&
+              WriteFile(config_.blob_path, blob_.data(), blob_.size());
+        Reset();
+    }
+
+    ~FakeDevice() {
+        std::string cmd = "rm -rf " + dir_;
+        if (system(cmd.c_str()))
+            LOG(WARNING) << "Could not remove " << dir_;
+    }
+
+    // Blanks the boot device, so depend partitions are rewritten each run
+    void Reset() {
+        unlink(config_.boot_part.c_str());
+        ok_ = ok_ && WriteFile(config_.boot_part, "", 0) &&
+              truncate(config_.boot_part.c_str(), boot_size_) == 0;
+    }
+
+    bool ok() const { return ok_; }
+    const UpdaterConfig& config() const { return config_; }
+    uint64_t payload_bytes() const { return payload_bytes_; }
+
+ private:
+    static BupEntrySpec Entry(const std::string& partition,
+                              std::vector<char> data) {
+        BupEntrySpec entry;
+
+        entry.partition = partition;
+        entry.data = std::move(data);
+        return entry;
+    }
+
+    std::string dir_;
+    UpdaterConfig config_;
+    std::vector<char> blob_;
+    uint64_t boot_size_ = 0;
+    uint64_t payload_bytes_ = 0;
+    bool truncate_ok_ = true;
+    bool ok_ = false;
+};
+
+// Changes the configuration of a device for one run of an iteration
+typedef std::function<void(UpdaterConfig* config, int run)> ConfigMutator;
+
+/*
+ * Times runs updates of device per iteration, each from a blank boot
+ * device and with the configuration of the device as mutate changes it.
+ */
+void RunUpdates(benchmark::State& state, FakeDevice& device,
+                const ConfigMutator& mutate, int runs = 1) {
+    if (!device.ok()) {
+        state.SkipWithError("Could not create the fake device");
+        return;
+    }
+
+    for (auto _ : state) {
+        for (int run = 0; run < runs; run++) {
+            state.PauseTiming();
+            device.Reset();
+            UpdaterConfig config = device.config();
+            if (mutate)
+                mutate(&config, run);
+            NvPayloadUpdate updater(config);
+            state.ResumeTiming();
+
+            if (updater.UpdateDriver() != kSuccess) {
+                state.SkipWithError("UpdateDriver failed");
+                return;
+            }
+        }
+    }
+
+    state.SetBytesProcessed(state.iterations() * runs * device.payload_bytes());
+}
+
+// Args: entry size in KiB, boot device entries, user partition entries,
+// BupCompression of the payload entries
+void BM_UpdateDriver(benchmark::State& state) {
+    FakeDevice device(state.range(0) * 1024, state.range(1), state.range(2),
+                      static_cast<BupCompression>(state.range(3)));
+
+    RunUpdates(state, device, nullptr);
+}
+
+BENCHMARK(BM_UpdateDriver)
+    ->ArgNames({ "entry_kb", "boot", "user", "codec" })
+    ->Args({ 64, 2, 2, kBupRaw })
+    ->Args({ 1024, 2, 2, kBupRaw })
+    ->Args({ 4096, 2, 2, kBupRaw })
+    ->Args({ 1024, 8, 8, kBupRaw })
+    ->Args({ 256, 32, 32, kBupRaw })
+    ->Args({ 32768, 1, 1, kBupRaw })
+    ->Args({ 4096, 2, 2, kBupZstd })
+    ->Args({ 4096, 2, 2, kBupLz4 })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Independent updaters, one per thread, each with its own fake device
+BENCHMARK(BM_UpdateDriver)
+    ->ArgNames({ "entry_kb", "boot", "user", "codec" })
+    ->Args({ 1024, 2, 2, kBupRaw })
+    ->Threads(4)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Args: chunk size in KiB, pipeline depth, for one large user partition
+void BM_Pipeline(benchmark::State& state) {
+    FakeDevice device(64 * 1024 * 1024, 0, 1, kBupRaw);
+
+    RunUpdates(state, device, [&](UpdaterConfig* config, int) {
+        config->chunk_size = state.range(0) * 1024;
+        config->pipeline_depth = state.range(1);
+    });
+}
+
+BENCHMARK(BM_Pipeline)
+    ->ArgNames({ "chunk_kb", "depth" })
+    ->ArgsProduct({ { 256, 1024, 4096 }, { 1, 2, 4 } })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Args: requests in flight per device, io_uring (1) or thread pool (0)
+void BM_IoEngine(benchmark::State& state) {
+    FakeDevice device(64 * 1024 * 1024, 0, 1, kBupRaw);
+
+    RunUpdates(state, device, [&](UpdaterConfig* config, int) {
+        config->io_depth = state.range(0);
+        config->io_uring = state.range(1);
+    });
+}
+
+BENCHMARK(BM_IoEngine)
+    ->ArgNames({ "io_depth", "uring" })
+    ->ArgsProduct({ { 1, 4, 8 }, { 0, 1 } })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Args: percent of each image that is zero, zero elision on (1) or off (0)
+void BM_ZeroElision(benchmark::State& state) {
+    FakeDevice device(16 * 1024 * 1024, 2, 2, kBupZstd, state.range(0));
+
+    RunUpdates(state, device, [&](UpdaterConfig* config, int) {
+        config->elide_zeroes = state.range(1);
+    });
+}
+
+BENCHMARK(BM_ZeroElision)
+    ->ArgNames({ "zero_pct", "elide" })
+    ->ArgsProduct({ { 0, 50, 90 }, { 0, 1 } })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Args: write budget of each disk in MiB/s (0 for none), latency target
+// in microseconds the budget adapts to (0 for none)
+void BM_WriteLimit(benchmark::State& state) {
+    FakeDevice device(16 * 1024 * 1024, 2, 2, kBupZstd);
+
+    RunUpdates(state, device, [&](UpdaterConfig* config, int) {
+        config->write_limit.bytes_per_sec = state.range(0) * 1024 * 1024;
+        config->write_limit.latency_us = state.range(1);
+    });
+}
+
+BENCHMARK(BM_WriteLimit)
+    ->ArgNames({ "limit_mbps", "latency_us" })
+    ->Args({ 0, 0 })
+    ->Args({ 256, 0 })
+    ->Args({ 64, 0 })
+    ->Args({ 256, 2000 })
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+// Args: both slots from one read (1), or one update of each slot (0)
+void BM_BothSlots(benchmark::State& state) {
+    FakeDevice device(16 * 1024 * 1024, 2, 2, kBupZstd);
+    bool both_slots = state.range(0);
+
+    RunUpdates(state, device, [&](UpdaterConfig* config, int run) {
+        config->both_slots = both_slots;
+        config->target_slot = run;
+    }, both_slots ? 1 : 2);
+
+    // Both slots are written either way
+    state.SetBytesProcessed(state.iterations() * 2 * device.payload_bytes());
+}
+
+BENCHMARK(BM_BothSlots)
+    ->ArgNames({ "both" })
+    ->Arg(0)
+    ->Arg(1)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    android::base::SetMinimumLogSeverity(android::base::ERROR);
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
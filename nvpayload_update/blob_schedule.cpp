@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "blob_schedule.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+void BlobSchedule::Reset(int fd, size_t window) {
+    fd_ = fd;
+    window_ = window;
+    steps_.clear();
+    uses_.clear();
+    next_ = 0;
+}
+
+void BlobSchedule::Add(uint64_t pos, uint64_t len) {
+    Range range(pos, len);
+
+    steps_.push_back({ range, false });
+    uses_[range].steps++;
+}
+
+void BlobSchedule::Begin(uint64_t pos, uint64_t len) {
+    Range range(pos, len);
+
+    for (size_t i = next_; i < steps_.size(); i++) {
+        if (!steps_[i].begun && steps_[i].range == range) {
+            steps_[i].begun = true;
+            break;
+        }
+    }
+    while (next_ < steps_.size() && steps_[next_].begun)
+        next_++;
+
+    Hint();
+}
+
+bool BlobSchedule::Release(uint64_t pos, uint64_t len) {
+    auto use = uses_.find(Range(pos, len));
+
+    if (use == uses_.end() || !use->second.steps)
+        return false;
+
+    if (--use->second.steps)
+        return false;
+
+    Drop(use->first);
+    return true;
+}
+
+int BlobSchedule::Pending(uint64_t pos, uint64_t len) const {
+    auto use = uses_.find(Range(pos, len));
+
+    return use == uses_.end() ? 0 : use->second.steps;
+}
+
+/*
+ * The window is counted over the ranges of the next steps whether or not
+ * they were hinted before, as those are still taking up cache. Of a range
+ * larger than what is left of it only the start is hinted; the kernel
+ * reads ahead the rest as it is read.
+ */
+void BlobSchedule::Hint() {
+    uint64_t left = window_;
+
+    for (size_t i = next_; i < steps_.size() && left; i++) {
+        const Range& range = steps_[i].range;
+        Use& use = uses_[range];
+        uint64_t len = std::min<uint64_t>(range.second, left);
+
+        if (steps_[i].begun || !use.steps)
+            continue;
+
+        if (!use.hinted && fd_ >= 0) {
+            posix_fadvise(fd_, range.first, len, POSIX_FADV_WILLNEED);
+            use.hinted = true;
+        }
+        left -= len;
+    }
+}
+
+void BlobSchedule::Drop(const Range& range) {
+    uint64_t page = sysconf(_SC_PAGESIZE);
+    uint64_t start = range.first - range.first % page;
+    uint64_t end = range.first + range.second;
+    auto live = [&](uint64_t from, uint64_t to) {
+        for (auto& [other, use] : uses_) {
+            if (use.steps && other.first < to &&
+                other.first + other.second > from)
+                return true;
+        }
+        return false;
+    };
+
+    // Pages at the edges may hold a neighbour that is still to be read
+    if (start < range.first && live(start, range.first))
+        start += page;
+    if (end % page) {
+        uint64_t up = end - end % page + page;
+
+        end = live(end, up) ? end - end % page : up;
+    }
+
+    if (fd_ >= 0 && end > start)
+        posix_fadvise(fd_, start, end - start, POSIX_FADV_DONTNEED);
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_BLOB_SCHEDULE_H_
+#define NV_BLOB_SCHEDULE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <utility>
+#include <vector>
+
+// Blob bytes ahead of the current read that are asked to be cached
+#define BLOB_READAHEAD_SIZE (8 * 1024 * 1024)
+
+/*
+ * The blob ranges an update is going to read, in the order it reads
+ * them. As each step begins, the ranges of the steps after it are handed
+ * to the kernel to be read ahead, up to a window, so a step never waits
+ * for the storage the blob is on. Once the last step that reads a range
+ * is released, its pages are dropped from the cache, leaving alone those
+ * shared with a range that is still to be read.
+ *
+ * A step that is skipped is still to be begun and released. Ranges are
+ * hinted and dropped on fd; nothing else is done with it.
+ */
+class BlobSchedule {
+ public:
+    // Forgets all steps
+    void Reset(int fd, size_t window = BLOB_READAHEAD_SIZE);
+
+    void Add(uint64_t pos, uint64_t len);
+    // Starts the first step of the range not begun yet
+    void Begin(uint64_t pos, uint64_t len);
+    // Ends a step of the range. Returns true if it was the last one.
+    bool Release(uint64_t pos, uint64_t len);
+    // Steps of the range not released yet
+    int Pending(uint64_t pos, uint64_t len) const;
+
+ private:
+    typedef std::pair<uint64_t, uint64_t> Range;
+
+    struct Step {
+        Range range;
+        bool begun;
+    };
+
+    struct Use {
+        int steps = 0;      // not released yet
+        bool hinted = false;
+    };
+
+    void Hint();
+    void Drop(const Range& range);
+
+    int fd_ = -1;
+    size_t window_ = BLOB_READAHEAD_SIZE;
+    std::vector<Step> steps_;
+    size_t next_ = 0;       // first step not begun
+    std::map<Range, Use> uses_;
+};
+
+#endif  // NV_BLOB_SCHEDULE_H_
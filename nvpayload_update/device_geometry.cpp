@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "device_geometry.h"
+
+#include <android-base/logging.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/fs.h>
+#include <linux/major.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+
+static bool PowerOfTwo(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+
+static uint32_t ReadSysfs(const std::string& path) {
+    std::ifstream file(path);
+    uint64_t value = 0;
+
+    if (!(file >> value) || value > UINT32_MAX)
+        return 0;
+
+    return value;
+}
+
+uint32_t DeviceGeometry::WriteAlign(uint32_t floor) const {
+    uint32_t align = mtd ? erase_size :
+                     std::max({ logical_block_size, physical_block_size,
+                                min_io_size });
+
+    if (!PowerOfTwo(align) || align > GEOMETRY_IO_MAX)
+        return floor;
+
+    return std::max(align, floor);
+}
+
+uint32_t DeviceGeometry::WriteChunk() const {
+    uint32_t chunk = optimal_io_size ? optimal_io_size : erase_size;
+
+    return chunk <= GEOMETRY_IO_MAX ? chunk : 0;
+}
+
+std::string SysfsDisk(const std::string& path) {
+    struct stat st;
+    char real[PATH_MAX];
+
+    if (stat(path.c_str(), &st))
+        return path;
+
+    // A file is on the disk of the file system it is on
+    dev_t dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+    std::string sys = "/sys/dev/block/" + std::to_string(major(dev)) + ":" +
+                      std::to_string(minor(dev));
+
+    if (!realpath(sys.c_str(), real))
+        return sys;
+
+    std::string device(real);
+    if (access((device + "/partition").c_str(), F_OK) == 0)
+        device.erase(device.rfind('/'));
+
+    return device;
+}
+
+/*
+ * The queue attributes of the disk are what the ioctls report for a
+ * block device, so they stand in when the device can not be opened, and
+ * for a file. An MTD device reports its erase block through the MTD
+ * class instead.
+ */
+bool ProbeDeviceGeometry(const std::string& path, DeviceGeometry* geo) {
+    std::string queue = SysfsDisk(path) + "/queue/";
+    struct stat st;
+    bool found = false;
+    int fd;
+
+    if (stat(path.c_str(), &st))
+        return false;
+
+    if (S_ISBLK(st.st_mode) && major(st.st_rdev) == MTD_BLOCK_MAJOR) {
+        std::string mtd = "/sys/class/mtd/mtd" +
+                          std::to_string(minor(st.st_rdev)) + "/";
+
+        geo->mtd = true;
+        geo->erase_size = ReadSysfs(mtd + "erasesize");
+        found = true;
+    }
+
+    fd = S_ISBLK(st.st_mode) ? open(path.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+    if (fd >= 0) {
+        int logical = 0;
+        unsigned int value = 0;
+
+        if (!ioctl(fd, BLKSSZGET, &logical) && logical > 0)
+            geo->logical_block_size = logical;
+        if (!ioctl(fd, BLKPBSZGET, &value))
+            geo->physical_block_size = value;
+        if (!ioctl(fd, BLKIOMIN, &value))
+            geo->min_io_size = value;
+        if (!ioctl(fd, BLKIOOPT, &value))
+            geo->optimal_io_size = value;
+        close(fd);
+    }
+
+    for (auto [field, name] : {
+             std::make_pair(&geo->logical_block_size, "logical_block_size"),
+             std::make_pair(&geo->physical_block_size, "physical_block_size"),
+             std::make_pair(&geo->min_io_size, "minimum_io_size"),
+             std::make_pair(&geo->optimal_io_size, "optimal_io_size") }) {
+        if (!*field)
+            *field = ReadSysfs(queue + name);
+        found |= *field != 0;
+    }
+
+    return found;
+}
+
+bool LoadGeometryOverride(const std::string& file, DeviceGeometry* geo) {
+    std::ifstream in(file);
+    std::string line;
+
+    if (!in.is_open())
+        return false;
+
+    while (std::getline(in, line)) {
+        size_t eq = line.find('=');
+
+        if (line.empty() || line[0] == '#')
+            continue;
+
+        std::string name = line.substr(0, eq);
+        uint32_t value = (eq == std::string::npos) ? 0 :
+                         strtoul(line.c_str() + eq + 1, nullptr, 0);
+
+        if (name == "logical_block_size")
+            geo->logical_block_size = value;
+        else if (name == "physical_block_size")
+            geo->physical_block_size = value;
+        else if (name == "minimum_io_size")
+            geo->min_io_size = value;
+        else if (name == "optimal_io_size")
+            geo->optimal_io_size = value;
+        else if (name == "erase_size")
+            geo->erase_size = value;
+        else if (name == "mtd")
+            geo->mtd = value != 0;
+        else {
+            LOG(ERROR) << file << ": unknown geometry " << line;
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_DEVICE_GEOMETRY_H_
+#define NV_DEVICE_GEOMETRY_H_
+
+#include <stdint.h>
+
+#include <string>
+
+// Larger alignments or chunks than this are not followed
+#define GEOMETRY_IO_MAX (16 * 1024 * 1024)
+
+/*
+ * What a device says about the sizes it is best written in. Fields the
+ * device does not report are 0.
+ */
+struct DeviceGeometry {
+    uint32_t logical_block_size = 0;
+    uint32_t physical_block_size = 0;
+    uint32_t min_io_size = 0;
+    uint32_t optimal_io_size = 0;
+    uint32_t erase_size = 0;        // of an MTD device
+    bool mtd = false;
+
+    // Multiple of offset and length writes are best aligned to, at least
+    // floor. An MTD device is aligned to its erase blocks.
+    uint32_t WriteAlign(uint32_t floor) const;
+    // Multiple long writes are best split into, 0 if there is none
+    uint32_t WriteChunk() const;
+};
+
+// Sysfs directory of the disk path is on, or of path if it is a disk
+std::string SysfsDisk(const std::string& path);
+
+/*
+ * Reads the geometry of the device path is, or of the disk a file is on,
+ * from the device and its sysfs queue attributes. Returns false if
+ * nothing was found out.
+ */
+bool ProbeDeviceGeometry(const std::string& path, DeviceGeometry* geo);
+
+/*
+ * Replaces fields of geo with those set in file, given as name=value
+ * lines with the names of the sysfs queue attributes, erase_size and mtd.
+ * Returns false if file could not be read or has a line it does not know.
+ */
+bool LoadGeometryOverride(const std::string& file, DeviceGeometry* geo);
+
+#endif  // NV_DEVICE_GEOMETRY_H_
@@ -21,10 +21,14 @@
 
 #include "gpttegra.h"
 
+#include <string.h>
 #include <iostream>
 
 using namespace std;
 
+std::mutex GPTDataTegra::snapshotLock;
+std::unordered_map<std::string, GPTDataTegra::IndexSnapshot> GPTDataTegra::snapshots;
+
 /********************************************
  *                                          *
  * GPTDataTegra class and related structures *
@@ -37,40 +41,117 @@ GPTDataTegra::GPTDataTegra(void) : GPTData() {
 GPTDataTegra::~GPTDataTegra(void) {
 } // default destructor
 
-// Loads the GPT, as much as possible. Returns 1 if this seems to have
-// succeeded, 0 if there are obvious problems....
-int GPTDataTegra::LoadTegraGPTData(void) {
-   int allOK = ForceLoadGPTData();
-
-   // For emmc boot devices, Tegra combines boot0 and boot1, which breaks
-   // normal gpt library calculations. Adjust some header locations to match
-   // what is expected.
+// For emmc boot devices, Tegra combines boot0 and boot1, which breaks
+// normal gpt library calculations. Adjust some header locations to match
+// what is expected.
+void GPTDataTegra::AdjustTegraBoot1(void) {
    if (device.find("boot1") != std::string::npos &&
        secondHeader.lastUsableLBA > diskSize) {
       mainHeader.lastUsableLBA -= diskSize;
       secondHeader.lastUsableLBA -= diskSize;
       secondHeader.partitionEntriesLBA -= diskSize;
    }
+} // GPTDataTegra::AdjustTegraBoot1()
+
+// Loads only what Tegra uses: the backup header and the partition array it
+// points to. No MBR, main table or consistency checks. While the backup
+// header read from the device is unchanged since the last load of the same
+// device, the partition index built then is reused and the array is not
+// read at all. Returns 1 if the header and array are valid, 0 otherwise.
+int GPTDataTegra::LoadTegraPartitionIndex(void) {
+   GPTHeader header;
+   int err = 0, crcOk = 0, allOK;
+
+   if (!myDisk.OpenForRead(device)) {
+      cerr << "Could not open " << device << " to read its GPT\n";
+      return 0;
+   } // if
+
+   blockSize = myDisk.GetBlockSize();
+   diskSize = myDisk.DiskSize(&err);
+   allOK = diskSize > 0 && LoadHeader(&header, myDisk, diskSize - 1, &crcOk) &&
+           crcOk && header.signature == GPT_SIGNATURE;
+   if (!allOK) {
+      cerr << "No valid backup GPT header on " << device << "\n";
+      myDisk.Close();
+      return 0;
+   } // if
+
+   {
+      std::lock_guard<std::mutex> lock(snapshotLock);
+      auto it = snapshots.find(device);
+
+      if (it != snapshots.end() && it->second.blockSize == blockSize &&
+          it->second.diskSize == diskSize &&
+          memcmp(&it->second.header, &header, sizeof(header)) == 0) {
+         myDisk.Close();
+         secondHeader = header;
+         AdjustTegraBoot1();
+         extents = it->second.extents;
+         nameIndex = it->second.nameIndex;
+         return 1;
+      } // if
+   }
 
-   allOK = LoadSecondTableAsMain() && allOK;
-
-   return allOK;
-} // GPTData::LoadTegraGPTData()
+   secondHeader = header;
+   AdjustTegraBoot1();
+   allOK = LoadPartitionTable(secondHeader, myDisk) && mainPartsCrcOk;
+   myDisk.Close();
+   if (!allOK) {
+      cerr << "GPT partition array on " << device << " is damaged\n";
+      extents.clear();
+      nameIndex.clear();
+      return 0;
+   } // if
+
+   BuildPartitionIndex();
+
+   std::lock_guard<std::mutex> lock(snapshotLock);
+   IndexSnapshot& snapshot = snapshots[device];
+   snapshot.header = header;
+   snapshot.blockSize = blockSize;
+   snapshot.diskSize = diskSize;
+   snapshot.extents = extents;
+   snapshot.nameIndex = nameIndex;
+
+   return 1;
+} // GPTDataTegra::LoadTegraPartitionIndex()
+
+// Converts every partition entry once, so later lookups neither scan the
+// table nor convert descriptions again. The first of duplicate names wins,
+// as with the former linear search.
+void GPTDataTegra::BuildPartitionIndex(void) {
+   uint32_t lbaSize = GetBlockSize();
+   uint32_t count = numParts < 256 ? numParts : 256;
+
+   extents.assign(count, PartExtent());
+   nameIndex.clear();
+   nameIndex.reserve(count);
+
+   for (uint32_t i = 0; i < count; i++) {
+      if (!partitions[i].IsUsed())
+         continue;
+
+      extents[i].offset = partitions[i].GetFirstLBA() * lbaSize;
+      extents[i].size = partitions[i].GetLengthLBA() * lbaSize;
+      nameIndex.emplace(partitions[i].GetDescription(), i);
+   }
+} // GPTDataTegra::BuildPartitionIndex()
 
 uint64_t GPTDataTegra::GetOffset(uint8_t index) {
-   return partitions[index].GetFirstLBA() * GetBlockSize();
+   return index < extents.size() ? extents[index].offset : 0;
 } // GPTData::GetOffset()
 
 uint64_t GPTDataTegra::GetSize(uint8_t index) {
-   return partitions[index].GetLengthLBA() * GetBlockSize();
+   return index < extents.size() ? extents[index].size : 0;
 } // GPTData::GetSize()
 
-bool GPTDataTegra::MatchPartition(std::string part_name, uint8_t *index) {
-   for (uint8_t i = 0; i < numParts; i++) {
-      if (part_name.compare(partitions[i].GetDescription()) == 0) {
-         *index = i;
-         return true;
-      }
+bool GPTDataTegra::MatchPartition(const std::string& part_name, uint8_t *index) {
+   auto it = nameIndex.find(part_name);
+
+   if (it != nameIndex.end()) {
+      *index = it->second;
+      return true;
    }
 
    *index = 0;
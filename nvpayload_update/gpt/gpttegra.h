@@ -23,19 +23,48 @@
 
 #include "gpt.h"
 
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
 using namespace std;
 
 class GPTDataTegra : public GPTData {
    protected:
+      struct PartExtent {
+         uint64_t offset;
+         uint64_t size;
+      };
+
+      // Byte extents by partition index, and partition index by name
+      std::vector<PartExtent> extents;
+      std::unordered_map<std::string, uint8_t> nameIndex;
+
+      // Index of a device as last loaded, with the backup header it came
+      // from; reused while the header on the device is the same
+      struct IndexSnapshot {
+         GPTHeader header;
+         uint32_t blockSize;
+         uint64_t diskSize;
+         std::vector<PartExtent> extents;
+         std::unordered_map<std::string, uint8_t> nameIndex;
+      };
+
+      static std::mutex snapshotLock;
+      static std::unordered_map<std::string, IndexSnapshot> snapshots;
+
+      void BuildPartitionIndex(void);
+      void AdjustTegraBoot1(void);
    public:
       GPTDataTegra(void);
       ~GPTDataTegra(void);
 
-      int LoadTegraGPTData(void);
+      int LoadTegraPartitionIndex(void);
 
       uint64_t GetOffset(uint8_t index);
       uint64_t GetSize(uint8_t index);
-      bool MatchPartition(std::string part_name, uint8_t *index);
+      bool MatchPartition(const std::string& part_name, uint8_t *index);
 }; // class GPTDataTegra
 
 #endif // __GPTDATATEGRA_H
@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "io_engine.h"
+
+#include <android-base/logging.h>
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Files a ring can have registered at once
+#define URING_FILE_SLOTS 8
+
+bool IoEngine::Submit(IoRequest* req) {
+    req->done = 0;
+    req->result = 0;
+
+    if (!Start(req))
+        return false;
+
+    in_flight_++;
+    return true;
+}
+
+IoRequest* IoEngine::Reap() {
+    if (!in_flight_)
+        return nullptr;
+
+    IoRequest* req = Complete();
+    if (req)
+        in_flight_--;
+    return req;
+}
+
+bool IoEngine::Run(IoRequest* reqs, size_t count) {
+    size_t next = 0;
+    int error = 0;
+
+    while (next < count || in_flight_) {
+        while (next < count && !full() && !error) {
+            if (!Submit(&reqs[next])) {
+                error = errno;
+                reqs[next].result = -error;
+            }
+            next++;
+        }
+        if (error)
+            next = count;
+
+        if (!in_flight_)
+            break;
+
+        IoRequest* req = Reap();
+        if (!req) {
+            errno = EIO;
+            return false;
+        }
+        if (req->result < 0 && !error)
+            error = -req->result;
+        else if ((size_t) req->result != req->len && !error)
+            error = EIO;
+    }
+
+    errno = error;
+    return !error;
+}
+
+/*
+ * Moves all of req in a loop of blocking calls. Only a read may end
+ * early, at the end of the file.
+ */
+static ssize_t Transfer(IoRequest* req) {
+    while (req->done < req->len) {
+        char* data = req->data + req->done;
+        size_t len = req->len - req->done;
+        uint64_t offset = req->offset + req->done;
+        ssize_t bytes = req->write ? pwrite(req->fd, data, len, offset)
+                                   : pread(req->fd, data, len, offset);
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -errno;
+        if (!bytes)
+            return req->write ? -ENOSPC : req->done;
+        req->done += bytes;
+    }
+
+    return req->done;
+}
+
+/*
+ * Fallback for kernels without io_uring, or where policy denies it: each
+ * of depth threads runs one request at a time.
+ */
+class ThreadPoolEngine : public IoEngine {
+ public:
+    explicit ThreadPoolEngine(size_t depth) : IoEngine(depth) {
+        for (size_t i = 0; i < depth; i++)
+            workers_.emplace_back(&ThreadPoolEngine::Work, this);
+    }
+
+    ~ThreadPoolEngine() override {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread& worker : workers_)
+            worker.join();
+    }
+
+    const char* name() const override { return "threads"; }
+
+ protected:
+    bool Start(IoRequest* req) override {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            queued_.push_back(req);
+        }
+        cv_.notify_all();
+        return true;
+    }
+
+    IoRequest* Complete() override {
+        std::unique_lock<std::mutex> lock(mu_);
+
+        cv_.wait(lock, [this] { return !completed_.empty(); });
+
+        IoRequest* req = completed_.front();
+        completed_.pop_front();
+        return req;
+    }
+
+ private:
+    void Work() {
+        std::unique_lock<std::mutex> lock(mu_);
+
+        while (true) {
+            cv_.wait(lock, [this] { return stop_ || !queued_.empty(); });
+            if (stop_)
+                return;
+
+            IoRequest* req = queued_.front();
+            queued_.pop_front();
+
+            lock.unlock();
+            req->result = Transfer(req);
+            lock.lock();
+
+            completed_.push_back(req);
+            cv_.notify_all();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<IoRequest*> queued_;
+    std::deque<IoRequest*> completed_;
+    bool stop_ = false;
+};
+
+/*
+ * io_uring, set up with the raw system calls. The ring has room for depth
+ * submissions and twice as many completions, so neither can overflow.
+ */
+class UringEngine : public IoEngine {
+ public:
+    explicit UringEngine(size_t depth) : IoEngine(depth) {}
+
+    ~UringEngine() override {
+        if (sqes_)
+            munmap(sqes_, sqes_len_);
+        if (cq_ptr_ && cq_ptr_ != sq_ptr_)
+            munmap(cq_ptr_, cq_len_);
+        if (sq_ptr_)
+            munmap(sq_ptr_, sq_len_);
+        if (ring_fd_ >= 0)
+            close(ring_fd_);
+    }
+
+    // False with errno set if the kernel has no io_uring for us
+    bool Setup() {
+        struct io_uring_params params;
+
+        memset(&params, 0, sizeof(params));
+        ring_fd_ = syscall(__NR_io_uring_setup, depth(), &params);
+        if (ring_fd_ < 0)
+            return false;
+
+        sq_len_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_len_ = params.cq_off.cqes +
+                  params.cq_entries * sizeof(struct io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            sq_len_ = cq_len_ = std::max(sq_len_, cq_len_);
+
+        sq_ptr_ = Map(sq_len_, IORING_OFF_SQ_RING);
+        if (!sq_ptr_)
+            return false;
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+            cq_ptr_ = sq_ptr_;
+        else if (!(cq_ptr_ = Map(cq_len_, IORING_OFF_CQ_RING)))
+            return false;
+        sqes_len_ = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes_ = static_cast<struct io_uring_sqe*>(Map(sqes_len_, IORING_OFF_SQES));
+        if (!sqes_)
+            return false;
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        char* cq = static_cast<char*>(cq_ptr_);
+
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // A sparse file table, filled as files are registered
+        files_.assign(URING_FILE_SLOTS, -1);
+        files_registered_ = syscall(__NR_io_uring_register, ring_fd_,
+                                    IORING_REGISTER_FILES, files_.data(),
+                                    files_.size()) == 0;
+        return true;
+    }
+
+    const char* name() const override { return "io_uring"; }
+
+    bool RegisterBuffers(const std::vector<char*>& buffers,
+                         size_t size) override {
+        std::vector<struct iovec> iov;
+
+        if (!buffers_.empty() || buffers.empty())
+            return false;
+
+        for (char* buffer : buffers)
+            iov.push_back({ buffer, size });
+
+        // Pinned memory counts against RLIMIT_MEMLOCK on older kernels
+        if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                    iov.data(), iov.size()))
+            return false;
+
+        buffers_ = buffers;
+        buffer_size_ = size;
+        return true;
+    }
+
+    void UnregisterBuffers() override {
+        if (buffers_.empty())
+            return;
+
+        syscall(__NR_io_uring_register, ring_fd_, IORING_UNREGISTER_BUFFERS,
+                nullptr, 0);
+        buffers_.clear();
+    }
+
+    void RegisterFile(int fd) override {
+        if (files_registered_ && FileSlot(fd) < 0)
+            UpdateFile(FileSlot(-1), fd);
+    }
+
+    void UnregisterFile(int fd) override {
+        if (files_registered_ && FileSlot(fd) >= 0)
+            UpdateFile(FileSlot(fd), -1);
+    }
+
+ protected:
+    bool Start(IoRequest* req) override {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        struct io_uring_sqe* sqe = &sqes_[index];
+        int slot = FileSlot(req->fd);
+        int buffer = BufferIndex(req->data);
+
+        memset(sqe, 0, sizeof(*sqe));
+        if (slot >= 0) {
+            sqe->fd = slot;
+            sqe->flags = IOSQE_FIXED_FILE;
+        } else {
+            sqe->fd = req->fd;
+        }
+        sqe->off = req->offset + req->done;
+        sqe->user_data = reinterpret_cast<uintptr_t>(req);
+
+        if (buffer >= 0) {
+            sqe->opcode = req->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+            sqe->addr = reinterpret_cast<uintptr_t>(req->data + req->done);
+            sqe->len = req->len - req->done;
+            sqe->buf_index = buffer;
+        } else {
+            req->iov.iov_base = req->data + req->done;
+            req->iov.iov_len = req->len - req->done;
+            sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->addr = reinterpret_cast<uintptr_t>(&req->iov);
+            sqe->len = 1;
+        }
+
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+
+        while (true) {
+            int ret = syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0,
+                              nullptr, 0);
+            if (ret == 1)
+                return true;
+            if (ret < 0 && errno == EINTR)
+                continue;
+
+            // Nothing was consumed, so the entry can be taken back
+            __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+            if (!ret)
+                errno = EAGAIN;
+            return false;
+        }
+    }
+
+    IoRequest* Complete() override {
+        while (true) {
+            unsigned head = *cq_head_;
+
+            if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+                if (syscall(__NR_io_uring_enter, ring_fd_, 0, 1,
+                            IORING_ENTER_GETEVENTS, nullptr, 0) < 0 &&
+                    errno != EINTR) {
+                    PLOG(ERROR) << "Waiting for io_uring completions failed";
+                    return nullptr;
+                }
+                continue;
+            }
+
+            struct io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+            IoRequest* req = reinterpret_cast<IoRequest*>(cqe->user_data);
+            int res = cqe->res;
+
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+
+            if ((res == -EINTR || res == -EAGAIN) && Start(req))
+                continue;
+
+            if (res < 0) {
+                req->result = res;
+                return req;
+            }
+            if (!res) {
+                req->result = req->write ? -ENOSPC : req->done;
+                return req;
+            }
+
+            req->done += res;
+            if (req->done < req->len) {
+                if (Start(req))
+                    continue;
+                req->result = -errno;
+                return req;
+            }
+
+            req->result = req->done;
+            return req;
+        }
+    }
+
+ private:
+    void* Map(size_t len, off_t offset) {
+        void* ptr = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    int FileSlot(int fd) const {
+        if (!files_registered_)
+            return -1;
+
+        auto it = std::find(files_.begin(), files_.end(), fd);
+        return it == files_.end() ? -1 : it - files_.begin();
+    }
+
+    void UpdateFile(int slot, int fd) {
+        struct io_uring_files_update update;
+
+        if (slot < 0)
+            return;
+
+        memset(&update, 0, sizeof(update));
+        update.offset = slot;
+        update.fds = reinterpret_cast<uintptr_t>(&fd);
+        if (syscall(__NR_io_uring_register, ring_fd_,
+                    IORING_REGISTER_FILES_UPDATE, &update, 1) == 1)
+            files_[slot] = fd;
+    }
+
+    // Index of the registered buffer data points into, or -1
+    int BufferIndex(const char* data) const {
+        for (size_t i = 0; i < buffers_.size(); i++) {
+            if (data >= buffers_[i] && data < buffers_[i] + buffer_size_)
+                return i;
+        }
+
+        return -1;
+    }
+
+    int ring_fd_ = -1;
+    void* sq_ptr_ = nullptr;
+    void* cq_ptr_ = nullptr;
+    size_t sq_len_ = 0;
+    size_t cq_len_ = 0;
+    struct io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_len_ = 0;
+
+    unsigned* sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned* sq_array_ = nullptr;
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    struct io_uring_cqe* cqes_ = nullptr;
+
+    std::vector<char*> buffers_;
+    size_t buffer_size_ = 0;
+    std::vector<int> files_;
+    bool files_registered_ = false;
+};
+
+std::unique_ptr<IoEngine> IoEngine::Create(size_t depth, bool use_uring) {
+    depth = std::max<size_t>(depth, 1);
+
+    if (use_uring) {
+        std::unique_ptr<UringEngine> ring(new UringEngine(depth));
+
+        if (ring->Setup())
+            return ring;
+        PLOG(INFO) << "io_uring is not available, using threads for I/O";
+    }
+
+    return std::unique_ptr<IoEngine>(new ThreadPoolEngine(depth));
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_IO_ENGINE_H_
+#define NV_IO_ENGINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <vector>
+
+#define IO_QUEUE_DEPTH 4
+
+/*
+ * A positional read or write. The engine transfers all of it, retrying
+ * short transfers, and only a read that reaches the end of the file ends
+ * early.
+ */
+struct IoRequest {
+    int fd;
+    char* data;
+    size_t len;
+    uint64_t offset;
+    bool write;
+    ssize_t result;     // bytes transferred, or -errno, once reaped
+
+    // Owned by the engine while the request is in flight
+    size_t done;
+    struct iovec iov;
+};
+
+/*
+ * Keeps up to depth requests in flight on a device. Built on io_uring
+ * where the kernel and policy allow it, and on a pool of depth threads
+ * doing pread/pwrite otherwise.
+ *
+ * An engine is driven by one thread at a time.
+ */
+class IoEngine {
+ public:
+    static std::unique_ptr<IoEngine> Create(size_t depth, bool use_uring);
+    virtual ~IoEngine() {}
+
+    virtual const char* name() const = 0;
+    size_t depth() const { return depth_; }
+    size_t in_flight() const { return in_flight_; }
+    bool full() const { return in_flight_ >= depth_; }
+
+    /*
+     * Registered buffers and files save io_uring from pinning pages and
+     * looking up the file for each request. Requests for anything not
+     * registered work too. Only one set of buffers is registered at a
+     * time; false if it could not be.
+     */
+    virtual bool RegisterBuffers(const std::vector<char*>& buffers,
+                                 size_t size) { return true; }
+    virtual void UnregisterBuffers() {}
+    virtual void RegisterFile(int fd) {}
+    virtual void UnregisterFile(int fd) {}
+
+    // Starts req, which stays untouched until Reap returns it. Must not
+    // be called while full(). False with errno set if it was not started.
+    bool Submit(IoRequest* req);
+    // Waits for a request to complete; nullptr if none is in flight
+    IoRequest* Reap();
+    // Transfers all count requests and waits for them. True if each
+    // transferred all of its bytes.
+    bool Run(IoRequest* reqs, size_t count);
+
+ protected:
+    explicit IoEngine(size_t depth) : depth_(depth) {}
+
+    virtual bool Start(IoRequest* req) = 0;
+    virtual IoRequest* Complete() = 0;
+
+ private:
+    size_t depth_;
+    size_t in_flight_ = 0;
+};
+
+#endif  // NV_IO_ENGINE_H_
@@ -11,70 +11,387 @@
 #include "nv_bootloader_payload_updater.h"
 #include <android-base/logging.h>
 #include <android-base/properties.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/ioprio.h>
+#include <stdlib.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
 #include <string>
 #include <iostream>
+#include <sstream>
+#include <tuple>
 #include "gpt/gpttegra.h"
+#include "update_journal.h"
+#include "update_report.h"
 
 extern "C" {
 }
 
+static const DependPartition part_dependence[] = {
+    { "mb1", 0 },
+    { "BCT", 0 },
+    { "BCT", 1 },
+    { "mb1", 1 },
+};
+
+/*
+ * Pushes buffered data of a single stream down to the media right away,
+ * for writes that are not part of a phase.
+ */
+int NvPayloadUpdate::SyncStream(FILE* stream) {
+    ScopedTimer timer(&entry_report_->sync_us);
+
+    if (fflush(stream))
+        return -1;
+
+    return fdatasync(fileno(stream));
+}
+
+int NvPayloadUpdate::SyncStream(PartitionWriter& writer) {
+    ScopedTimer timer(&entry_report_->sync_us);
+
+    if (!writer.Flush())
+        return -1;
+
+    return fdatasync(writer.fd());
+}
+
 BLStatus NvPayloadUpdate::UpdateDriver() {
     BLStatus status;
+    std::ostringstream report;
+
+    report_.Start();
+    SetUpIo();
 
-    status = OTAUpdater(BLOB_PATH);
+    status = OTAUpdater(config_.blob_path.c_str());
     if (status != kSuccess) {
         LOG(ERROR) << "OTA Blob update failed. Status: "
             << static_cast<int>(status);
-       return status;
+    } else {
+        status = BMPUpdater(config_.bmp_path.c_str());
+        if (status != kSuccess) {
+            LOG(WARNING) << "BMP Blob update failed. Status: "
+                << static_cast<int>(status);
+           status = kSuccess;
+        }
     }
 
-    status = BMPUpdater(BMP_PATH);
-    if (status != kSuccess) {
-        LOG(WARNING) << "BMP Blob update failed. Status: "
-            << static_cast<int>(status);
-       status = kSuccess;
+    report_.Finish(status);
+    entry_report_ = &scratch_report_;
+
+    for (auto& [device, limiter] : write_limiters_) {
+        if (limiter && limiter->waited_us())
+            LOG(INFO) << "Writes to " << device << " waited "
+                << limiter->waited_us() / 1000 << " ms for their budget";
+    }
+    if (read_cache_.hits())
+        LOG(INFO) << "Payloads read from memory " << read_cache_.hits()
+            << " times, " << read_cache_.saved_bytes() / 1024
+            << " KiB not read from the blob again";
+
+    report_.Print(report, false);
+    LOG(INFO) << "Update report: " << report.str();
+
+    return status;
+}
+
+/*
+ * Reads the partitions of the target slots back at idle I/O priority, so
+ * they can be checked periodically while the device is in use. Intact
+ * entries are recorded in a journal of their own: a run that is cut
+ * short goes on with the next entry, and one that found a mismatch only
+ * checks the entries that did not match again.
+ */
+BLStatus NvPayloadUpdate::VerifyDriver() {
+    Payload payload;
+    UpdateJournal journal;
+    uint8_t id[SHA256_DIGEST_LENGTH];
+    std::ostringstream report;
+    int ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    int mismatches = 0;
+    BLStatus status;
+
+    // The slot of an update that is still to be resumed differs anyway
+    if (!config_.journal_path.empty() &&
+        access(config_.journal_path.c_str(), F_OK) == 0) {
+        LOG(INFO) << "An update is pending, not verifying";
+        return kSuccess;
+    }
+
+    report_.Start();
+    SetUpIo();
+    CpuBudget budget(config_.verify_cpu_percent);
+
+    if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+                IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0)))
+        PLOG(WARNING) << "Could not lower the I/O priority";
+    // The threads of an engine started from here on inherit the priority
+    std::unique_ptr<IoEngine> read_engine = std::move(read_engine_);
+    read_engine_ = IoEngine::Create(config_.io_depth, config_.io_uring);
+
+    status = OpenPayload(config_.blob_path.c_str(), &payload);
+    if (!status && !config_.verify_journal_path.empty() &&
+        PayloadId(&payload, id))
+        journal.Open(config_.verify_journal_path,
+                     config_.both_slots ? JOURNAL_BOTH_SLOTS : config_.target_slot,
+                     id);
+    budget.Throttle();
+
+    // The blob is read front to back, and an entry that fits the read
+    // cache once for all slots
+    std::vector<Entry*> order;
+    for (auto& entry : payload.entry_table)
+        order.push_back(&entry);
+    std::stable_sort(order.begin(), order.end(),
+                     [](Entry* a, Entry* b) { return a->pos < b->pos; });
+
+    if (!status) {
+        blob_schedule_.Reset(fileno(payload.blob_file));
+        for (Entry* entry : order) {
+            for (size_t i = 0; i < TargetSlots().size(); i++)
+                blob_schedule_.Add(entry->pos, entry->len);
+        }
     }
 
+    for (Entry* entry : order) {
+        for (int slot : TargetSlots()) {
+            blob_schedule_.Begin(entry->pos, entry->len);
+            if (journal.Done(entry->table_index, slot)) {
+                report_.Skip(entry->partition, slot,
+                             TargetPath(entry, slot), "resumed");
+                ReleaseRead(entry);
+                continue;
+            }
+
+            entry_report_ = report_.Begin(entry->partition, slot,
+                                          TargetPath(entry, slot));
+            BLStatus result = VerifiedPartition(entry, payload.blob_file,
+                                                slot, &budget);
+            if (result == kVerifyMismatch) {
+                LOG(ERROR) << entry->partition << " of slot " << slot
+                    << " does not match the payload";
+                entry_report_->mismatch = true;
+                mismatches++;
+            } else if (result) {
+                LOG(ERROR) << entry->partition << " of slot " << slot
+                    << " could not be verified";
+                status = kInternalError;
+            } else {
+                journal.Complete(entry->table_index, slot);
+            }
+            ReleaseRead(entry);
+        }
+    }
+    read_cache_.Clear();
+
+    if (!status && mismatches)
+        status = kVerifyMismatch;
+    if (!status)
+        journal.Remove();
+    else
+        journal.Close();
+
+    read_engine_ = std::move(read_engine);
+    if (ioprio >= 0)
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio);
+
+    report_.Finish(status);
+    entry_report_ = &scratch_report_;
+
+    report_.Print(report, false);
+    LOG(INFO) << "Verify report: " << report.str();
+
     return status;
 }
 
-uint8_t target_slot;
-std::string boot_part;
-std::string gpt_part;
-GPTDataTegra BootGPT;
-uint32_t br_block_size;
-uint32_t br_page_size;
+void NvPayloadUpdate::PrintReport(std::ostream& out) {
+    report_.Print(out, true);
+}
+
 
 NvPayloadUpdate::NvPayloadUpdate() {
+    UpdaterConfig config;
+
     // If suffix prop is empty, guess slot a
     std::string target_suffix = android::base::GetProperty("ro.boot.slot_suffix", "");
     // slot is the target slot, so opposite of current
-    target_slot = (target_suffix.compare("_b") == 0 ? 0 : 1);
+    config.target_slot = (target_suffix.compare("_b") == 0 ? 0 : 1);
+
+    config.boot_part = android::base::GetProperty("vendor.tegra.ota.boot_device", "");
+    config.gpt_part = android::base::GetProperty("vendor.tegra.ota.gpt_device",
+                                                 config.boot_part);
+    config.geometry_path = android::base::GetProperty("vendor.tegra.ota.geometry_file",
+                                                      "");
+    config.both_slots = android::base::GetBoolProperty("vendor.tegra.ota.both_slots",
+                                                       false);
+    config.write_limit.bytes_per_sec = 1024 * android::base::GetUintProperty<uint64_t>(
+        "vendor.tegra.ota.write_limit_kbps", 0);
+    config.write_limit.ops_per_sec = android::base::GetUintProperty<uint32_t>(
+        "vendor.tegra.ota.write_limit_iops", 0);
+    config.write_limit.latency_us = android::base::GetUintProperty<uint32_t>(
+        "vendor.tegra.ota.write_latency_us", 0);
+    config.read_cache_size = 1024 * android::base::GetUintProperty<size_t>(
+        "vendor.tegra.ota.read_cache_kb", READ_CACHE_SIZE / 1024);
+    config.read_cache_digest = android::base::GetBoolProperty(
+        "vendor.tegra.ota.read_cache_digest", true);
+
+    Init(config);
+}
 
-    boot_part = android::base::GetProperty("vendor.tegra.ota.boot_device", "");
-    gpt_part = android::base::GetProperty("vendor.tegra.ota.gpt_device", boot_part);
+NvPayloadUpdate::NvPayloadUpdate(const UpdaterConfig& config) {
+    Init(config);
+}
 
-    if (!gpt_part.empty()) {
-        BootGPT.SetDisk(gpt_part);
-        BootGPT.LoadTegraGPTData();
+void NvPayloadUpdate::Init(const UpdaterConfig& config) {
+    config_ = config;
+    config_.pipeline_depth = std::max<size_t>(config.pipeline_depth, 1);
+
+    read_cache_.SetBudget(config_.read_cache_size);
+}
+
+/*
+ * Buffers and I/O engines are only set up once an update or verification
+ * run starts, so a plan is made without them.
+ */
+void NvPayloadUpdate::SetUpIo() {
+    size_t chunk_size = ROUND_UP(std::max<size_t>(config_.chunk_size, 1),
+                                 DIRECT_IO_ALIGN);
+
+    if (read_engine_)
+        return;
+
+    LoadBootGeometry();
+    // Writes go out in whole optimal I/O units of the boot device
+    uint32_t optimal = boot_geometry_.WriteChunk();
+    if (optimal && optimal % DIRECT_IO_ALIGN == 0)
+        chunk_size = ROUND_UP(chunk_size, optimal);
+    buffer_pool_.Resize(chunk_size);
+
+    read_engine_ = IoEngine::Create(config_.io_depth, config_.io_uring);
+    for (size_t i = 0; i < TargetSlots().size(); i++) {
+        auto& engine = write_engines_[i];
+
+        engine = IoEngine::Create(config_.io_depth, config_.io_uring);
+        // Enough for the writes in flight, their readback and the next chunk
+        if (!engine->RegisterBuffers(
+                buffer_pool_.Reserve((i + 1) * (engine->depth() +
+                                                2 * config_.pipeline_depth + 2)),
+                buffer_pool_.size()))
+            LOG(INFO) << "Write buffers are not registered for I/O";
     }
+    LOG(INFO) << "I/O through " << write_engines_[0]->name() << ", "
+        << write_engines_[0]->depth() << " requests in flight per device";
+}
 
-    if (boot_part.compare("mtdblock") == 0) {
-        br_block_size = BR_QSPI_BLOCK_SIZE;
-	br_page_size = BR_QSPI_PAGE_SIZE;
-    } else { //if (boot_part.compare("boot0") == 0)
-        br_block_size = BR_EMMC_BLOCK_SIZE;
-	br_page_size = BR_EMMC_PAGE_SIZE;
+/*
+ * The boot device is probed for its geometry, which a file can replace
+ * field by field, so any kind of device can be stood in for by a file.
+ * The BootROM block and page sizes follow from it.
+ */
+void NvPayloadUpdate::LoadBootGeometry() {
+    if (geometry_loaded_)
+        return;
+
+    geometry_loaded_ = true;
+    boot_geometry_ = DeviceGeometry();
+
+    if (!config_.boot_part.empty())
+        ProbeDeviceGeometry(config_.boot_part, &boot_geometry_);
+    if (!config_.geometry_path.empty() &&
+        !LoadGeometryOverride(config_.geometry_path, &boot_geometry_))
+        LOG(WARNING) << "Could not apply geometry " << config_.geometry_path;
+
+    if (!config_.boot_part.empty())
+        LOG(INFO) << config_.boot_part << ": "
+            << (boot_geometry_.mtd ? "MTD, " : "")
+            << "logical block " << boot_geometry_.logical_block_size
+            << ", physical block " << boot_geometry_.physical_block_size
+            << ", minimum I/O " << boot_geometry_.min_io_size
+            << ", optimal I/O " << boot_geometry_.optimal_io_size
+            << ", erase block " << boot_geometry_.erase_size;
+
+    if (boot_geometry_.mtd) {
+        br_block_size_ = BR_QSPI_BLOCK_SIZE;
+        br_page_size_ = BR_QSPI_PAGE_SIZE;
+    } else {
+        br_page_size_ = std::max<uint32_t>(BR_EMMC_PAGE_SIZE,
+                                           boot_geometry_.logical_block_size);
+        br_block_size_ = ROUND_UP(BR_EMMC_BLOCK_SIZE, br_page_size_);
     }
 }
 
 NvPayloadUpdate::~NvPayloadUpdate() {
 }
 
+/*
+ * The GPT is only needed to place boot partition entries, so it is read
+ * when the first entry is matched against it, not for every update.
+ */
+bool NvPayloadUpdate::LoadBootGpt() {
+    if (config_.gpt_part.empty())
+        return false;
+
+    if (!gpt_loaded_) {
+        gpt_loaded_ = true;
+        boot_gpt_.SetDisk(config_.gpt_part);
+        if (!boot_gpt_.LoadTegraPartitionIndex())
+            LOG(WARNING) << "No usable GPT on " << config_.gpt_part
+                << ", writing all entries to user partitions";
+    }
+
+    return true;
+}
+
+/*
+ * Boot chain partitions of slot 1 carry a _b suffix, except BCT, which
+ * holds the copies of both slots. A slot without a partition of its own
+ * is placed on the one of the other slot.
+ */
+bool NvPayloadUpdate::MatchBootPartition(Entry* entry) {
+    std::string name(entry->partition);
+    bool found[2];
+
+    if (!LoadBootGpt())
+        return false;
+
+    found[0] = boot_gpt_.MatchPartition(name, &entry->index[0]);
+    if (entry->partition.compare("BCT") != 0)
+        name += "_b";
+    found[1] = boot_gpt_.MatchPartition(name, &entry->index[1]);
+
+    if (!found[0])
+        entry->index[0] = entry->index[1];
+    if (!found[1])
+        entry->index[1] = entry->index[0];
+
+    if (config_.both_slots)
+        return found[0] || found[1];
+
+    /*
+     * Otherwise only the target slot is written. The depend steps of
+     * either slot then land on its partition, as the copy of the running
+     * slot is its fallback if the update is cut short.
+     */
+    entry->index[!config_.target_slot] = entry->index[config_.target_slot];
+
+    return found[config_.target_slot];
+}
+
+std::vector<int> NvPayloadUpdate::TargetSlots() const {
+    if (config_.both_slots)
+        return { 0, 1 };
+
+    return { config_.target_slot };
+}
+
 BLStatus NvPayloadUpdate::BMPUpdater(const char* bmp_path) {
     FILE* blob_file;
     char* buffer;
-    std::string unused_path = std::string(PARTITION_PATH) + BMP_NAME;
     int bytes;
     int err;
     Header* header = new Header;
@@ -82,43 +399,82 @@ BLStatus NvPayloadUpdate::BMPUpdater(const char* bmp_path) {
     FILE* slot_stream;
     BLStatus status = kSuccess;
 
-    if (target_slot)
-        unused_path += "_b";
-
     blob_file = fopen(bmp_path, "r");
     if (!blob_file) {
+         delete header;
          return  kBlobOpenFailed;
     }
 
     // Parse Header
     buffer = new char[header_size];
     bytes = fread(buffer, 1, header_size, blob_file);
-    ParseHeaderInfo((unsigned char*) buffer, header);
+    if (!ParseHeaderInfo((unsigned char*) buffer, bytes, header) ||
+        header->size < HEADER_LEN_WO_RATCHET) {
+        LOG(ERROR) << "Invalid BMP blob header";
+        delete[] buffer;
+        delete header;
+        fclose(blob_file);
+        return kBlobOpenFailed;
+    }
     delete[] buffer;
 
     PrintHeader(header);
 
     err = fseek(blob_file, 0, SEEK_SET);
     buffer = new char[header->size];
-    bytes = fread(buffer, 1, header->size, blob_file);
+    uint64_t read_us = 0;
+    {
+        ScopedTimer timer(&read_us);
+        bytes = fread(buffer, 1, header->size, blob_file);
+    }
+    bool first = true;
 
-    LOG(INFO) << "Writing to " << unused_path << " for "
-              << BMP_NAME;
+    for (int slot : TargetSlots()) {
+        std::string unused_path = config_.partition_path + BMP_NAME;
 
-    slot_stream = fopen(unused_path.c_str(), "rb+");
-    if (!slot_stream) {
-        LOG(ERROR) << "Slot could not be opened "<< BMP_NAME;
-        status = kSlotOpenFailed;
-        goto exit;
-    }
+        if (slot)
+            unused_path += "_b";
 
-    bytes = fwrite(buffer, 1, header->size, slot_stream);
-    LOG(INFO) << "Bytes written to "<< BMP_NAME
-                << ": "<< bytes;
+        entry_report_ = report_.Begin(BMP_NAME, slot, unused_path);
+        // The blob is read once, for the first slot
+        if (first) {
+            entry_report_->bytes_read = bytes;
+            entry_report_->read_us = read_us;
+            first = false;
+        }
 
-    fclose(slot_stream);
+        if (bytes != (int) header->size) {
+            LOG(ERROR) << "BMP blob is truncated: " << bytes << " of "
+                << header->size << " bytes";
+            status = kBlobOpenFailed;
+            break;
+        }
+
+        LOG(INFO) << "Writing to " << unused_path << " for "
+                  << BMP_NAME;
+
+        slot_stream = fopen(unused_path.c_str(), "rb+");
+        if (!slot_stream) {
+            LOG(ERROR) << "Slot could not be opened "<< BMP_NAME;
+            status = kSlotOpenFailed;
+            break;
+        }
+
+        {
+            ScopedTimer timer(&entry_report_->write_us);
+            entry_report_->bytes_written = fwrite(buffer, 1, header->size,
+                                                  slot_stream);
+        }
+        LOG(INFO) << "Bytes written to "<< BMP_NAME
+                    << ": "<< entry_report_->bytes_written;
+
+        if (SyncStream(slot_stream)) {
+            PLOG(ERROR) << "Failed to sync " << unused_path;
+            status = kInternalError;
+        }
+        fclose(slot_stream);
+    }
 
-exit:
     delete[] buffer;
     delete header;
     fclose(blob_file);
@@ -126,64 +482,294 @@ exit:
     return status;
 }
 
-BLStatus NvPayloadUpdate::OTAUpdater(const char* ota_path) {
-    FILE* blob_file;
-    Header* header = new Header;
-    size_t header_size = sizeof(Header);
-    char* buffer = new char[header_size];
-    int bytes = 0;
+BLStatus NvPayloadUpdate::OpenPayload(const char* ota_path, Payload* payload) {
+    Header* header = &payload->header;
+    unsigned char buffer[sizeof(Header)];
+    size_t bytes = 0;
     int err;
-    BLStatus status = kSuccess;
 
-    blob_file = fopen(ota_path, "r");
-    if (!blob_file) {
+    payload->blob_file = fopen(ota_path, "r");
+    if (!payload->blob_file) {
         return  kBlobOpenFailed;
     }
 
     // Parse the header
-    bytes = fread(buffer, 1, header_size, blob_file);
-    ParseHeaderInfo((unsigned char*) buffer, header);
-    delete[] buffer;
+    bytes = fread(buffer, 1, sizeof(buffer), payload->blob_file);
+    bool header_ok = ParseHeaderInfo(buffer, bytes, header);
+
+    size_t entry_len = header_ok ? EntryLength(header) : 0;
+    if (!entry_len) {
+        LOG(ERROR) << "Invalid OTA blob header";
+        return  kBlobOpenFailed;
+    }
 
     PrintHeader(header);
 
-    uint8_t entry_len = ENTRY_LEN_WO_SPEC;
-    if (strncmp(header->magic, UPDATE_MAGIC_V2, UPDATE_MAGIC_SIZE) == 0)
-        entry_len += IMG_SPEC_INFO_LENGTH_V2;
-    else if (strncmp(header->magic, UPDATE_MAGIC_V3, UPDATE_MAGIC_SIZE) == 0)
-        entry_len += IMG_SPEC_INFO_LENGTH_V3;
-    else
-        return  kBlobOpenFailed;
+    // Parse the entry table. Entries point into table_buf.
+    uint64_t entry_table_size = (uint64_t) header->number_of_elements * entry_len;
 
-    // Parse the entry table
-    std::vector<Entry> entry_table;
-    int entry_table_size = header->number_of_elements * entry_len;
-    buffer = new char[entry_table_size];
-    err = fseek(blob_file, header->header_size, SEEK_SET);
-    bytes = fread(buffer, 1, entry_table_size, blob_file);
-    ParseEntryTable(buffer, entry_table, header);
-    delete[] buffer;
+    if ((uint64_t) header->header_size + entry_table_size > header->size) {
+        LOG(ERROR) << "Entry table does not fit in blob of "
+            << header->size << " bytes";
+        return kBlobOpenFailed;
+    }
+
+    payload->table_buf.resize(entry_table_size);
+    err = fseek(payload->blob_file, header->header_size, SEEK_SET);
+    bytes = fread(payload->table_buf.data(), 1, entry_table_size,
+                  payload->blob_file);
+    if (err || !ParseEntryTable(payload->table_buf.data(), bytes,
+                                payload->entry_table, header,
+                                &payload->skipped) ||
+        !ResolvePayloads(payload->entry_table, payload->blob_file, header)) {
+        LOG(ERROR) << "Invalid OTA blob entry table";
+        return kBlobOpenFailed;
+    }
+
+    if (!LoadDigests(ota_path, payload->blob_file, header, payload->digests))
+        return kBlobOpenFailed;
+
+    for (auto& entry : payload->entry_table) {
+        entry.digest = payload->digests.empty() ? nullptr :
+            &payload->digests[entry.table_index * SHA256_DIGEST_LENGTH];
+    }
+
+    // Entries that can share one read of their payload
+    for (auto& entry : payload->entry_table) {
+        for (auto& other : payload->entry_table) {
+            if (&other == &entry)
+                continue;
+
+            if ((other.pos == entry.pos && other.len == entry.len) ||
+                (config_.read_cache_digest && entry.digest && other.digest &&
+                 !memcmp(entry.digest, other.digest, SHA256_DIGEST_LENGTH)))
+                entry.repeated = true;
+        }
+    }
 
-    PrintEntryTable(entry_table, header);
+    return kSuccess;
+}
+
+/*
+ * The payload is identified by its header and entry table, and by the
+ * digest manifest, which covers every payload, if there is one. Without
+ * it the size of the blob stands in for the payloads, so that an update
+ * does not read the whole blob before it writes anything.
+ */
+bool NvPayloadUpdate::PayloadId(Payload* payload,
+                                uint8_t id[SHA256_DIGEST_LENGTH]) {
+    Header* header = &payload->header;
+    int fd = fileno(payload->blob_file);
+    AlignedBufferPool::Buffer buffer(&buffer_pool_);
+    struct stat st;
+    SHA256_CTX ctx;
+
+    if (!buffer.data())
+        return false;
+
+    if (fstat(fd, &st)) {
+        PLOG(ERROR) << "Could not stat the payload to identify it";
+        return false;
+    }
+
+    SHA256_Init(&ctx);
+    for (uint64_t pos = 0; pos < header->header_size; ) {
+        ssize_t bytes = pread(fd, buffer.data(),
+                              std::min<uint64_t>(buffer_pool_.size(),
+                                                 header->header_size - pos),
+                              pos);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0) {
+            PLOG(ERROR) << "Could not read the payload to identify it";
+            return false;
+        }
+        SHA256_Update(&ctx, buffer.data(), bytes);
+        pos += bytes;
+    }
+
+    SHA256_Update(&ctx, payload->table_buf.data(), payload->table_buf.size());
+    if (!payload->digests.empty()) {
+        SHA256_Update(&ctx, payload->digests.data(), payload->digests.size());
+    } else {
+        uint64_t size = st.st_size;
+
+        SHA256_Update(&ctx, &size, sizeof(size));
+    }
+    SHA256_Final(id, &ctx);
+
+    return true;
+}
+
+BLStatus NvPayloadUpdate::OTAUpdater(const char* ota_path) {
+    Payload payload;
+    BLStatus status;
+
+    status = OpenPayload(ota_path, &payload);
+    if (status)
+        return status;
+
+    PrintEntryTable(payload.entry_table, &payload.header);
+
+    if (!PayloadsFit(payload.entry_table))
+        return kBlobOpenFailed;
+
+    uint8_t id[SHA256_DIGEST_LENGTH];
+    if (!config_.journal_path.empty() && PayloadId(&payload, id))
+        journal_.Open(config_.journal_path,
+                      config_.both_slots ? JOURNAL_BOTH_SLOTS : config_.target_slot,
+                      id);
+
+    std::string tnspec = GetDeviceTNSpec();
+    for (auto& entry : payload.skipped) {
+        for (int slot : TargetSlots())
+            report_.Skip(entry.partition, slot, "", SkipReason(&entry, tnspec));
+    }
 
     // Write each partition
-    err = fseek(blob_file, 0, SEEK_SET);
-    status = WriteToPartition(entry_table, blob_file);
+    status = WriteToPartition(payload.entry_table, payload.blob_file);
+    CloseBootSession();
+    read_cache_.Clear();
     if (status) {
         LOG(ERROR) << "Writing to partitions failed.";
+        journal_.Close();
+    } else {
+        journal_.Remove();
     }
 
-    delete header;
-    fclose(blob_file);
-
     return status;
 }
 
-static int OffsetOfBootPartition(std::string part, int slot, uint8_t index) {
+// Hands a descriptor with all writes issued over to the current phase
+int NvPayloadUpdate::AddToPhase(const std::string& path, int written_fd) {
+    for (auto& device : phase_devices_) {
+        if (device.path == path)
+            return 0;
+    }
+
+    int fd = dup(written_fd);
+    if (fd < 0)
+        return -1;
+
+    phase_devices_.push_back({ path, fd });
+    return 0;
+}
+
+int NvPayloadUpdate::OffsetOfBootPartition(std::string_view part, int slot,
+                                           uint8_t index) {
     if ((part.compare("BCT") == 0) && slot)
-        return ROUND_UP(br_block_size, BootGPT.GetBlockSize());
+        return ROUND_UP(br_block_size_, boot_gpt_.GetBlockSize());
 
-    return BootGPT.GetOffset(index);
+    return boot_gpt_.GetOffset(index);
+}
+
+void NvPayloadUpdate::BuildPlan(Payload* payload, std::vector<PlanStep>& plan) {
+    LoadBootGeometry();
+
+    std::string tnspec = GetDeviceTNSpec();
+    uint64_t boot_bps = boot_geometry_.mtd ? PLAN_QSPI_WRITE_BPS :
+                                             PLAN_EMMC_WRITE_BPS;
+    int num_part = sizeof(part_dependence)/sizeof(*part_dependence);
+
+    auto add_step = [&](Entry* entry, int slot, const char* action) {
+        PlanStep step = { entry, slot, "", 0, entry->size, action, "", 0 };
+        uint64_t bps = boot_bps;
+
+        if (entry->type == kUserPartition) {
+            step.path = UserPartitionPath(entry, slot);
+            bps = PLAN_USER_WRITE_BPS;
+        } else if (!entry->partition.compare("BCT")) {
+            BctGeometry geo;
+
+            geo.block_size = br_block_size_;
+            geo.page_size = br_page_size_;
+            geo.lba_size = boot_gpt_.GetBlockSize();
+            geo.part_size = boot_gpt_.GetSize(entry->index[slot]);
+
+            std::vector<BctWrite> copies = PlanBctWrites(geo, entry->size, slot);
+            step.path = config_.boot_part;
+            step.offset = copies.empty() ? 0 : copies.front().offset;
+            step.bytes = copies.size() * entry->size;
+        } else {
+            step.path = config_.boot_part;
+            step.offset = OffsetOfBootPartition(entry->partition, slot,
+                                                entry->index[slot]);
+        }
+
+        step.estimated_ms = step.bytes * 1000 / bps +
+                            entry->size * 1000 / PLAN_VERIFY_BPS;
+        plan.push_back(step);
+    };
+
+    for (Entry* entry : WriteOrder(payload->entry_table)) {
+        for (int slot : TargetSlots())
+            add_step(entry, slot, "write");
+    }
+
+    // Depend partitions are only written when they differ from the payload
+    for (int i = 0; i < num_part; i++) {
+        Entry* entry = GetEntryTable(part_dependence[i].name,
+                                     payload->entry_table);
+        if (entry)
+            add_step(entry, part_dependence[i].slot, "write_if_changed");
+    }
+
+    for (auto& entry : payload->skipped) {
+        for (int slot : TargetSlots()) {
+            PlanStep step = { &entry, slot, "", 0, entry.len, "skip",
+                              SkipReason(&entry, tnspec), 0 };
+
+            plan.push_back(step);
+        }
+    }
+}
+
+BLStatus NvPayloadUpdate::PlanDriver(std::ostream& out) {
+    Payload payload;
+    std::vector<PlanStep> plan;
+    uint64_t total_bytes = 0;
+    uint64_t total_ms = 0;
+    BLStatus status;
+
+    status = OpenPayload(config_.blob_path.c_str(), &payload);
+    if (status) {
+        LOG(ERROR) << "OTA Blob could not be planned. Status: "
+            << static_cast<int>(status);
+        return status;
+    }
+
+    BuildPlan(&payload, plan);
+
+    out << "{\n  \"blob\": ";
+    PrintJsonString(out, config_.blob_path);
+    out << ",\n  \"boot_device\": ";
+    PrintJsonString(out, config_.boot_part);
+    out << ",\n  \"target_slot\": " << static_cast<int>(config_.target_slot)
+        << ",\n  \"both_slots\": " << (config_.both_slots ? "true" : "false")
+        << ",\n  \"steps\": [";
+
+    for (size_t i = 0; i < plan.size(); i++) {
+        const PlanStep& step = plan[i];
+
+        out << (i ? "," : "") << "\n    { \"partition\": ";
+        PrintJsonString(out, step.entry->partition);
+        out << ", \"slot\": " << step.slot << ", \"path\": ";
+        PrintJsonString(out, step.path);
+        out << ", \"offset\": " << step.offset
+            << ", \"bytes\": " << step.bytes
+            << ", \"codec\": \"" << PayloadCodecName(step.entry->codec)
+            << "\", \"action\": \"" << step.action
+            << "\", \"reason\": \"" << step.reason
+            << "\", \"estimated_ms\": " << step.estimated_ms << " }";
+
+        total_bytes += step.bytes;
+        total_ms += step.estimated_ms;
+    }
+
+    out << "\n  ],\n  \"total_bytes\": " << total_bytes
+        << ",\n  \"estimated_ms\": " << total_ms << "\n}\n";
+
+    return kSuccess;
 }
 
 BLStatus NvPayloadUpdate::EnableBootPartitionWrite(int enable) {
@@ -191,12 +777,12 @@ BLStatus NvPayloadUpdate::EnableBootPartitionWrite(int enable) {
     int bytes = 0;
 
     // Only needed for emmc boot partitions
-    if (boot_part.find("boot0") == std::string::npos)
+    if (config_.boot_part.find("boot0") == std::string::npos)
         return kSuccess;
 
-    fd = fopen(BP_ENABLE_PATH, "rb+");
+    fd = fopen(config_.bp_enable_path.c_str(), "rb+");
     if (!fd) {
-        LOG(ERROR) << "BP_ENABLE_PATH could not be opened ";
+        LOG(ERROR) << config_.bp_enable_path << " could not be opened ";
         return kFsOpenFailed;
     }
 
@@ -209,7 +795,25 @@ BLStatus NvPayloadUpdate::EnableBootPartitionWrite(int enable) {
     return kSuccess;
 }
 
-bool NvPayloadUpdate::IsDependPartition(std::string partition) {
+BLStatus NvPayloadUpdate::CommitPhase() {
+    BLStatus status = kSuccess;
+
+    for (auto& device : phase_devices_) {
+        uint64_t start = NowUs();
+
+        if (fdatasync(device.fd)) {
+            PLOG(ERROR) << "Failed to sync " << device.path;
+            status = kInternalError;
+        }
+        report_.AddSync(NowUs() - start);
+        close(device.fd);
+    }
+    phase_devices_.clear();
+
+    return status;
+}
+
+bool NvPayloadUpdate::IsDependPartition(std::string_view partition) {
     unsigned int i;
 
     for (i = 0; i < sizeof(part_dependence)/sizeof(*part_dependence); i++) {
@@ -222,227 +826,538 @@ bool NvPayloadUpdate::IsDependPartition(std::string partition) {
 
 BLStatus NvPayloadUpdate::WriteToBctPartition(Entry *entry_table,
                                                 FILE *blob_file,
-                                                FILE *bootp,
+                                                int boot_fd,
                                                 int slot) {
-    int bytes = 0;
-    unsigned pages_in_bct = 0;
-    unsigned slot_size = 0;
-    unsigned bct_count = 0;
-    int offset = 0;
-    int bin_size = entry_table->len;
+    int bin_size = entry_table->size;
+    BctGeometry geo;
+    BLStatus status = kSuccess;
 
-    /*
-     * Read update binary from blob
-     */
-    unsigned char* new_bct = new unsigned char[bin_size];
-    fseek(blob_file, entry_table->pos, SEEK_SET);
-    bytes = fread(new_bct, 1, bin_size, blob_file);
+    geo.block_size = br_block_size_;
+    geo.page_size = br_page_size_;
+    geo.lba_size = boot_gpt_.GetBlockSize();
+    geo.part_size = boot_gpt_.GetSize(entry_table->index[slot]);
 
-    /*
-     * Read current BCT from boot partition
-     */
-    unsigned char *cur_bct = new unsigned char[bin_size];
-    fseek(bootp, 0, SEEK_SET);
-    bytes = fread(cur_bct, 1, bin_size, bootp);
+    std::vector<BctWrite> plan = PlanBctWrites(geo, bin_size, slot);
 
-    pages_in_bct = DIV_CEIL(bin_size, br_page_size);
+    // Each copy must stay within the partition, not only the buffer
+    for (const BctWrite& write : plan) {
+        if (write.offset + bin_size > geo.part_size) {
+            LOG(ERROR) << entry_table->partition << " copy at " << write.offset
+                << " does not fit in " << geo.part_size << " bytes";
+            return kInternalError;
+        }
+    }
 
     /*
-    The term "slot" refers to a potential location
-    of a BCT in a block. A slot is the smallest integral
-    number of pages that can hold a BCT.Thus, every
-    BCT begins at the start of a page and may span
-    multiple pages. A block is a space in memory that
-    can hold multiple slots of BCTs.
-    */
-    slot_size = pages_in_bct * br_page_size;
+     * Read update binary from blob
+     */
+    AlignedBufferPool::Buffer pooled(&buffer_pool_);
+    std::vector<char> large;
+    char* new_bct = pooled.data();
 
-    /*
-    The BCT search sequence followed by BootROM is:
-    Block 0, Slot 0
-    Block 0, Slot 1
-    Block 1, Slot 0
-    Block 1, Slot 1
-    Block 1, Slot 2
-    .....
-    Block 1, Slot N
-    Block 2, Slot 0
-    .....
-    Block 2, Slot N
-    .....
-    Block 63, Slot N
-    Based on the search sequence, we write the
-    block 0, slot 1 BCT first, followed by one BCT
-    in slot 0 of subsequent blocks and lastly one BCT
-    in block0, slot 0.
-    */
+    if (!new_bct || (size_t) bin_size > buffer_pool_.size()) {
+        large.resize(bin_size);
+        new_bct = large.data();
+    }
 
-    if (slot)
-        goto block_1;
+    if (!ReadPayload(entry_table, blob_file, new_bct))
+        return kInternalError;
 
-    /*
-     * Write one BCT to slot 1, block 0
-     * if blocksize is bigger than twice of slotsize
-     */
-    offset = ROUND_UP(slot_size, BootGPT.GetBlockSize());
-    if (br_block_size > offset) {
-        fseek(bootp, offset, SEEK_SET);
-        bytes = fwrite(new_bct, 1, bin_size, bootp);
+    // The barriers count as syncs, the rest as writes
+    uint64_t start = NowUs();
+    uint64_t sync_us = 0;
+    int ret = ExecuteBctPlan(boot_fd, plan, new_bct, bin_size, &sync_us);
 
-        LOG(INFO) << entry_table->partition << " write: offset = " << slot_size
-            << " bytes = " << bytes;
+    entry_report_->sync_us += sync_us;
+    entry_report_->write_us += NowUs() - start - sync_us;
+    if (ret) {
+        PLOG(ERROR) << entry_table->partition << " write failed";
+        status = kInternalError;
+    } else {
+        LOG(INFO) << entry_table->partition << " write: copies = "
+            << plan.size() << " bytes = " << bin_size;
+        entry_report_->bytes_written += plan.size() * bin_size;
     }
 
-    /* Finally write to block 0, slot 0 */
-    offset = 0;
-    fseek(bootp, offset, SEEK_SET);
-    bytes = fwrite(new_bct, 1, bin_size, bootp);
+    return status;
+}
 
-    LOG(INFO) << entry_table->partition << " write: offset = " << offset
-           << " bytes = " << bytes;
+/*
+ * The boot device is unlocked and opened once for all boot entries, not
+ * per entry, and stays so until the update is done with it.
+ */
+BLStatus NvPayloadUpdate::OpenBootSession() {
+    if (boot_files_.is_open())
+        return kSuccess;
 
-    goto exit;
+    if (config_.boot_part.empty())
+        return kFsOpenFailed;
 
-block_1:
-    /* Fill Slot 0 for all other blocks */
-    offset = ROUND_UP(br_block_size, BootGPT.GetBlockSize());
-    while (offset < BootGPT.GetSize(entry_table->index)) {
-        fseek(bootp, offset, SEEK_SET);
-        bytes = fwrite(new_bct, 1, bin_size, bootp);
+    if (!boot_unlocked_) {
+        if (EnableBootPartitionWrite(1))
+            return kFsOpenFailed;
+        boot_unlocked_ = true;
+    }
 
-        LOG(INFO) << entry_table->partition << " write: offset = " << offset
-              << " bytes = " << bytes;
+    if (!boot_files_.Open(config_.boot_part, config_.direct_io,
+                          &boot_geometry_)) {
+        PLOG(ERROR) << "Boot Partition could not be opened "
+            << config_.boot_part;
+        return kFsOpenFailed;
+    }
 
-        offset += ROUND_UP(br_block_size, BootGPT.GetBlockSize());
-        bct_count++;
-        if (bct_count >= BCT_MAX_COPIES - 1)
-            break;
+    return kSuccess;
+}
+
+void NvPayloadUpdate::CloseBootSession() {
+    boot_files_.Close();
+
+    if (boot_unlocked_) {
+        EnableBootPartitionWrite(0);
+        boot_unlocked_ = false;
     }
+}
 
-exit:
-    delete[] cur_bct;
-    delete[] new_bct;
+/*
+ * All partitions of a disk, of both slots, share its budget. A latency
+ * target alone limits nothing; it steers the rates it comes with.
+ */
+RateLimiter* NvPayloadUpdate::WriteLimiter(const std::string& path) {
+    std::string device = RateLimiter::DeviceOf(path);
+    auto it = write_limiters_.find(device);
+
+    if (it != write_limiters_.end())
+        return it->second.get();
+
+    RateLimit limit = config_.write_limit;
+    auto custom = config_.device_write_limits.find(
+        device.substr(device.rfind('/') + 1));
+    if (custom != config_.device_write_limits.end())
+        limit = custom->second;
+
+    std::unique_ptr<RateLimiter>& limiter = write_limiters_[device];
+    if (limit.bytes_per_sec || limit.ops_per_sec) {
+        limiter = std::make_unique<RateLimiter>(limit);
+        LOG(INFO) << "Writes to " << device << " limited to "
+            << limit.bytes_per_sec / 1024 << " KiB/s, "
+            << limit.ops_per_sec << " requests/s"
+            << (limiter->adaptive() ? ", adapting to latency" : "");
+    }
 
-    return kSuccess;
+    return limiter.get();
 }
 
 BLStatus NvPayloadUpdate::WriteToBootPartition(Entry *entry_table,
                                                FILE* blob_file,
                                                int slot) {
-    int bin_size = entry_table->len;
-    FILE* bootp;
-    int bytes = 0;
     BLStatus status = kSuccess;
-    int offset = 0;
 
-    if (boot_part.empty())
-        return kFsOpenFailed;
+    if (entry_table->partition.compare("BCT"))
+        return WriteToSlots(entry_table, blob_file, {{ slot, entry_report_ }});
 
-    status = EnableBootPartitionWrite(1);
-    if (status) {
-        return kFsOpenFailed;
+    status = OpenBootSession();
+    if (status)
+        return status;
+
+    // The copies are placed by the plan, so they go through the buffered
+    // descriptor rather than the aligned one
+    status = WriteToBctPartition(entry_table, blob_file,
+                                 boot_files_.buffered_fd >= 0 ?
+                                 boot_files_.buffered_fd : boot_files_.fd,
+                                 slot);
+
+    if (AddToPhase(config_.boot_part, boot_files_.fd)) {
+        PLOG(ERROR) << "Failed to flush " << config_.boot_part;
+        status = kInternalError;
     }
 
-    bootp = fopen(boot_part.c_str(), "rb+");
-    if (!bootp) {
-        LOG(ERROR) << "Boot Partition could not be opened "
-            << entry_table->partition;
-        status = EnableBootPartitionWrite(0);
+    return status;
+}
 
-        return kFsOpenFailed;
+/*
+ * The payload is read once and each chunk of it is submitted to the
+ * writers of all slots before the next one is read, so the slots are
+ * written side by side, each through its own I/O engine.
+ */
+BLStatus NvPayloadUpdate::WriteToSlots(Entry *entry_table, FILE* blob_file,
+                                       const std::vector<std::pair<int, EntryReport*>>& slots) {
+    bool user = (entry_table->type == kUserPartition);
+    std::deque<SlotTarget> targets;
+    uint64_t bytes = 0;
+    BLStatus status = kSuccess;
+
+    if (!user) {
+        status = OpenBootSession();
+        if (status)
+            return status;
     }
 
-    if (!entry_table->partition.compare("BCT")) {
-        status = WriteToBctPartition(entry_table, blob_file, bootp, slot);
-    } else {
-        /*
-         * Read update binary from blob
-         */
-        char* buffer = new char[bin_size];
-        fseek(blob_file, entry_table->pos, SEEK_SET);
-        bytes = fread(buffer, 1, bin_size, blob_file);
-
-        offset = OffsetOfBootPartition(entry_table->partition, slot, entry_table->index);
-
-        fseek(bootp, offset , SEEK_SET);
-        bytes = fwrite(buffer, 1, bin_size, bootp);
-        fflush(bootp);
-        delete[] buffer;
+    for (auto& [slot, report] : slots) {
+        std::string path = TargetPath(entry_table, slot);
+        uint64_t offset = user ? 0 :
+            OffsetOfBootPartition(entry_table->partition, slot,
+                                  entry_table->index[slot]);
+        bool shared = false;
+
+        // Both slots may be placed on the same partition
+        for (auto& target : targets)
+            shared |= (target.path == path && target.offset == offset);
+        if (shared) {
+            report->skip_reason = "shared";
+            continue;
+        }
+
+        SlotTarget& target = targets.emplace_back(slot, report, &buffer_pool_,
+                                                  write_engines_[targets.size()].get());
+        target.path = path;
+        target.offset = offset;
+        if (!(user ? target.writer.Open(path, offset, config_.direct_io) :
+                     target.writer.Open(&boot_files_, offset))) {
+            PLOG(ERROR) << "Slot could not be opened " << entry_table->partition
+                << " (" << path << ")";
+            return user ? kSlotOpenFailed : kFsOpenFailed;
+        }
+        target.writer.EnableReadback(config_.pipeline_depth);
+        if (config_.elide_zeroes)
+            target.writer.EnableZeroElision();
+        target.writer.SetRateLimiter(WriteLimiter(path));
+
+        LOG(INFO) << "Writing to " << path << " for "
+            << entry_table->partition;
+    }
 
-        LOG(INFO) << entry_table->partition
-            << " write: offset = " << offset << " bytes = " << bytes;
+    status = StreamPayload(entry_table, blob_file, targets, &bytes);
 
-        if (VerifiedPartition(entry_table, blob_file, slot)) {
-            LOG(ERROR) << "Failed to write " << entry_table->partition;
+    for (auto& target : targets) {
+        LOG(INFO) << entry_table->partition << " write: " << target.path
+            << " offset = " << target.offset << " bytes = " << bytes
+            << (target.writer.direct() ? " (direct)" : "");
+
+        if (AddToPhase(target.path, target.writer.fd())) {
+            PLOG(ERROR) << "Failed to flush " << target.path;
             status = kInternalError;
         }
     }
 
-    fclose(bootp);
-    EnableBootPartitionWrite(0);
-
     return status;
 }
 
-void NvPayloadUpdate::GetEntryTable(std::string part, Entry *entry_t,
-                                    std::vector<Entry>& entry_table) {
-    for (auto entry : entry_table) {
-        if (!entry.partition.compare(part)) {
-            *entry_t = entry;
-            break;
-        }
+NvPayloadUpdate::Entry* NvPayloadUpdate::GetEntryTable(std::string_view part,
+                                                      std::vector<Entry>& entry_table) {
+    for (auto& entry : entry_table) {
+        if (!entry.partition.compare(part))
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+/*
+ * Boot entries go first and in ascending offset, so the boot device,
+ * which may be slow to seek (QSPI) or erase out of order, is swept once
+ * from front to back. User partitions follow in blob order, as nothing
+ * but the blob is read out of order for them.
+ */
+std::vector<NvPayloadUpdate::Entry*> NvPayloadUpdate::WriteOrder(
+        std::vector<Entry>& entry_table) {
+    std::vector<std::pair<uint64_t, Entry*>> boot;
+    std::vector<Entry*> order;
+    int slot = TargetSlots().front();
+
+    for (auto& entry : entry_table) {
+        if (entry.type == kBootPartition)
+            boot.push_back({ OffsetOfBootPartition(entry.partition, slot,
+                                                   entry.index[slot]),
+                             &entry });
+    }
+    std::stable_sort(boot.begin(), boot.end(),
+                     [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    for (auto& [offset, entry] : boot)
+        order.push_back(entry);
+    for (auto& entry : entry_table) {
+        if (entry.type == kUserPartition)
+            order.push_back(&entry);
+    }
+    std::stable_sort(order.begin() + boot.size(), order.end(),
+                     [](Entry* a, Entry* b) { return a->pos < b->pos; });
+
+    return order;
+}
+
+std::vector<NvPayloadUpdate::Entry*> NvPayloadUpdate::DependEntries(
+        std::vector<Entry>& entry_table) {
+    std::vector<Entry*> depend;
+
+    for (auto& entry : entry_table) {
+        if (entry.type == kDependPartition)
+            depend.push_back(&entry);
+    }
+    std::stable_sort(depend.begin(), depend.end(),
+                     [](Entry* a, Entry* b) { return a->pos < b->pos; });
+
+    return depend;
+}
+
+/*
+ * One step per entry written outside the depend order, which covers its
+ * readback too, one per depend payload that is hashed up front, and one
+ * per depend step. The steps are begun and released where
+ * WriteToPartition and WriteToDependPartition read.
+ */
+void NvPayloadUpdate::ScheduleReads(std::vector<Entry>& entry_table,
+                                    FILE* blob_file) {
+    int num_part = sizeof(part_dependence)/sizeof(*part_dependence);
+
+    blob_schedule_.Reset(fileno(blob_file));
+
+    for (Entry* entry : WriteOrder(entry_table))
+        blob_schedule_.Add(entry->pos, entry->len);
+
+    for (Entry* entry : DependEntries(entry_table)) {
+        if (entry->digest)
+            blob_schedule_.Add(entry->pos, entry->len);
+    }
+
+    for (int i = 0; i < num_part; i++) {
+        Entry* entry = GetEntryTable(part_dependence[i].name, entry_table);
+
+        if (entry)
+            blob_schedule_.Add(entry->pos, entry->len);
     }
 }
 
-int NvPayloadUpdate::VerifiedPartition(Entry *entry_table,
-                                           FILE *blob_file,
-                                           int slot) {
-    FILE *fd;
-    int offset;
-    int bin_size = entry_table->len;
-    char* source = new char[bin_size];
-    char* target = new char[bin_size];
-    int result;
+std::string NvPayloadUpdate::UserPartitionPath(Entry *entry_table, int slot) {
+    std::string path(config_.partition_path);
+
+    path.append(entry_table->partition);
+
+    if (slot)
+        path += "_b";
+    // Certain os facing partitions have to use _a instead of empty for slot 0
+    else if (entry_table->partition.compare("kernel-dtb") == 0)
+        path += "_a";
 
-    if (boot_part.empty())
+    return path;
+}
+
+std::string NvPayloadUpdate::TargetPath(Entry *entry_table, int slot) {
+    if (entry_table->type == kUserPartition)
+        return UserPartitionPath(entry_table, slot);
+
+    return config_.boot_part;
+}
+
+const char* NvPayloadUpdate::SkipReason(Entry *entry_table,
+                                        const std::string& tnspec) {
+    if (!entry_table->spec_info.empty() &&
+        entry_table->spec_info.compare(tnspec) != 0)
+        return "tnspec";
+
+    return "op_mode";
+}
+
+BLStatus NvPayloadUpdate::VerifiedPartition(Entry *entry_table,
+                                            FILE *blob_file,
+                                            int slot,
+                                            const CpuBudget* budget,
+                                            android::base::LogSeverity severity) {
+    ScopedTimer timer(&entry_report_->verify_us);
+
+    if (entry_table->type == kUserPartition)
+        return VerifyPartitionData(UserPartitionPath(entry_table, slot), 0,
+                                   entry_table, blob_file, budget, severity);
+
+    if (config_.boot_part.empty())
         return kFsOpenFailed;
 
-    fd = fopen(boot_part.c_str(), "r");
+    return VerifyPartitionData(config_.boot_part,
+                               OffsetOfBootPartition(entry_table->partition, slot,
+                                                     entry_table->index[slot]),
+                               entry_table, blob_file, budget, severity);
+}
 
-    offset = OffsetOfBootPartition(entry_table->partition, slot, entry_table->index);
+/*
+ * Opens path for readback. O_DIRECT is preferred; files that refuse it
+ * (tmpfs, some fuse mounts) are read buffered after dropping their cached
+ * pages, which were already synced by the writer.
+ */
+static int OpenForVerify(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+    if (fd >= 0 || errno != EINVAL)
+        return fd;
 
-    fseek(fd, offset, SEEK_SET);
-    fread(source, 1, bin_size, fd);
-    fclose(fd);
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
 
-    fseek(blob_file, entry_table->pos, SEEK_SET);
-    fread(target, 1, bin_size, blob_file);
+    return fd;
+}
 
-    result = memcmp(target, source, bin_size);
+BLStatus NvPayloadUpdate::VerifyPartitionData(const std::string& path,
+                                              uint64_t offset,
+                                              Entry *entry_table,
+                                              FILE *blob_file,
+                                              const CpuBudget* budget,
+                                              android::base::LogSeverity severity) {
+    uint64_t bin_size = entry_table->size;
+    uint64_t dev_pos = offset - (offset % DIRECT_IO_ALIGN);
+    uint64_t dev_end = ROUND_UP(offset + bin_size, DIRECT_IO_ALIGN);
+    uint64_t done = 0;
+    AlignedBufferPool::Buffer buffer(&buffer_pool_);
+    char* source = buffer.data();
+    const char* target = nullptr;
+    ssize_t target_len = 0;
+    BLStatus result = kSuccess;
+    // Boot entries are read back through the session, if there is one
+    bool borrowed = (path == boot_files_.path && boot_files_.verify_fd >= 0);
+    int fd;
+
+    fd = borrowed ? boot_files_.verify_fd : OpenForVerify(path);
+    if (fd < 0) {
+        PLOG(ERROR) << "Failed to open " << path << " for verification";
+        return kFsOpenFailed;
+    }
+
+    if (!source) {
+        if (!borrowed)
+            close(fd);
+        return kInternalError;
+    }
+
+    std::unique_ptr<PayloadStream> stream = OpenStream(entry_table, blob_file);
+
+    while (dev_pos < dev_end && !result) {
+        size_t chunk = std::min<uint64_t>(buffer_pool_.size(), dev_end - dev_pos);
+        ssize_t bytes = pread(fd, source, chunk, dev_pos);
+
+        // Part of the chunk that belongs to the entry payload
+        uint64_t skip = (dev_pos < offset) ? offset - dev_pos : 0;
+        size_t want = std::min<uint64_t>(chunk - skip, bin_size - done);
+
+        if (bytes < 0) {
+            PLOG(ERROR) << "Readback of " << path << " failed at "
+                << dev_pos;
+            result = kInternalError;
+            break;
+        }
+
+        // A short device read is a mismatch at the first missing byte
+        size_t avail = (static_cast<size_t>(bytes) > skip) ? bytes - skip : 0;
+        size_t cmp = 0;
+
+        // Payload chunks do not line up with device chunks
+        while (cmp < want) {
+            if (!target_len) {
+                target_len = stream->Next(&target);
+                if (target_len <= 0) {
+                    LOG(ERROR) << entry_table->partition
+                        << " payload could not be read";
+                    result = kInternalError;
+                    break;
+                }
+            }
+
+            size_t n = std::min<size_t>(want - cmp, target_len);
+            size_t i = 0;
 
-    delete[] target;
-    delete[] source;
+            if (cmp + n > avail ||
+                memcmp(source + skip + cmp, target, n) != 0) {
+                size_t limit = (avail > cmp) ? std::min(avail - cmp, n) : 0;
+
+                while (i < limit && source[skip + cmp + i] == target[i])
+                    i++;
+
+                LOG(severity) << entry_table->partition << " mismatch in " << path
+                    << " at payload offset " << done + cmp + i
+                    << " (device offset " << offset + done + cmp + i << ")";
+                result = kVerifyMismatch;
+                break;
+            }
+
+            cmp += n;
+            target += n;
+            target_len -= n;
+        }
+
+        done += want;
+        dev_pos += chunk;
+
+        if (budget)
+            budget->Throttle();
+    }
+
+    if (!borrowed)
+        close(fd);
 
     return result;
 }
 
 BLStatus NvPayloadUpdate::WriteToDependPartition(std::vector<Entry>& entry_table,
                                                  FILE* blob_file) {
-    Entry entry_t;
+    Entry* entry_t;
     BLStatus status = kSuccess;
     int slot, i;
     int num_part = sizeof(part_dependence)/sizeof(*part_dependence);
 
+    /*
+     * These partitions are shared by the boot chain of both slots, so
+     * their payloads are checked before the first of them is written.
+     */
+    for (Entry* entry : DependEntries(entry_table)) {
+        if (!entry->digest)
+            continue;
+
+        blob_schedule_.Begin(entry->pos, entry->len);
+        if (!CheckPayloadDigest(entry, blob_file))
+            return kInternalError;
+        ReleaseRead(entry);
+    }
+
     for (i = 0; i < num_part; i++) {
         slot = part_dependence[i].slot;
-        GetEntryTable(part_dependence[i].name, &entry_t, entry_table);
-        if (VerifiedPartition(&entry_t, blob_file, slot)) {
-            status = (entry_t.write)(&entry_t, blob_file, slot);
+        entry_t = GetEntryTable(part_dependence[i].name, entry_table);
+        if (!entry_t) {
+            LOG(WARNING) << part_dependence[i].name << " not in payload";
+            continue;
+        }
+
+        blob_schedule_.Begin(entry_t->pos, entry_t->len);
+        if (journal_.Done(entry_t->table_index, slot)) {
+            report_.Skip(entry_t->partition, slot,
+                               TargetPath(entry_t, slot), "resumed");
+            ReleaseRead(entry_t);
+            continue;
+        }
+
+        entry_report_ = report_.Begin(entry_t->partition, slot,
+                                           TargetPath(entry_t, slot));
+        // A step that differs is expected here, it is what gets written
+        if (!VerifiedPartition(entry_t, blob_file, slot, nullptr,
+                               android::base::INFO)) {
+            entry_report_->skip_reason = "unchanged";
+        } else {
+            /*
+             * Each step is its own phase: it is durable and read back
+             * before the next one, which relies on it, is written.
+             */
+            status = (this->*entry_t->write)(entry_t, blob_file, slot);
+            BLStatus commit = CommitPhase();
+            if (!status)
+                status = commit;
+            if (!status && VerifiedPartition(entry_t, blob_file, slot)) {
+                LOG(ERROR) << "Failed to write " << entry_t->partition;
+                status = kInternalError;
+            }
             if (status) {
-                LOG(ERROR) << entry_t.partition <<" update failed ";
+                LOG(ERROR) << entry_t->partition <<" update failed ";
+                // What was checkpointed may be what failed, so redo it all
+                journal_.Checkpoint(entry_t->table_index, slot, 0);
                 return kInternalError;
             }
         }
+        journal_.Complete(entry_t->table_index, slot);
+        ReleaseRead(entry_t);
     }
 
     return status;
@@ -451,53 +1366,73 @@ BLStatus NvPayloadUpdate::WriteToDependPartition(std::vector<Entry>& entry_table
 BLStatus NvPayloadUpdate::WriteToUserPartition(Entry *entry_table,
                                                FILE* blob_file,
                                                int slot) {
-    std::string unused_path = std::string(PARTITION_PATH) + entry_table->partition;
-    FILE* slot_stream;
-    int bytes = 0;
-    int part_size = entry_table->len;
-
-    if (slot)
-        unused_path += "_b";
-    // Certain os facing partitions have to use _a instead of empty for slot 0
-    else if (entry_table->partition.compare("kernel-dtb") == 0)
-        unused_path += "_a";
+    return WriteToSlots(entry_table, blob_file, {{ slot, entry_report_ }});
+}
 
-    slot_stream = fopen(unused_path.c_str(), "rb+");
-    if (!slot_stream) {
-        LOG(ERROR) << "Slot could not be opened "<< entry_table->partition;
-        return  kSlotOpenFailed;
-    }
+BLStatus NvPayloadUpdate::WriteToPartition(std::vector<Entry>& entry_table,
+                                           FILE* blob_file) {
+    std::vector<std::tuple<Entry*, int, EntryReport*>> written;
+    BLStatus status = kSuccess;
 
-    char* buffer = new char[part_size];
-    fseek(blob_file, entry_table->pos, SEEK_SET);
-    bytes = fread(buffer, 1, part_size, blob_file);
+    ScheduleReads(entry_table, blob_file);
 
-    LOG(INFO) << "Writing to " << unused_path << " for "
-        << entry_table->partition;
+    // Non-dependent partitions have no order among them
+    for (Entry* entry : WriteOrder(entry_table)) {
+        std::vector<std::pair<int, EntryReport*>> slots;
 
-    bytes = fwrite(buffer, 1, part_size, slot_stream);
-    LOG(INFO) << entry_table->partition
-        << " write: bytes = " << bytes;
+        blob_schedule_.Begin(entry->pos, entry->len);
 
-    delete[] buffer;
-    fclose(slot_stream);
+        for (int slot : TargetSlots()) {
+            if (journal_.Done(entry->table_index, slot)) {
+                report_.Skip(entry->partition, slot,
+                             TargetPath(entry, slot), "resumed");
+                continue;
+            }
+            slots.push_back({ slot, report_.Begin(entry->partition, slot,
+                                                  TargetPath(entry, slot)) });
+        }
+        if (slots.empty()) {
+            ReleaseRead(entry);
+            continue;
+        }
 
-    return kSuccess;
-}
+        // The payload is read once, for the first slot
+        entry_report_ = slots.front().second;
+        status = WriteToSlots(entry, blob_file, slots);
+        if (status) {
+            LOG(INFO) << entry->partition
+                << " fail to write ";
+            for (auto& slot : slots)
+                journal_.Checkpoint(entry->table_index, slot.first, 0);
+            CommitPhase();
+            return status;
+        }
+        for (auto& [slot, report] : slots)
+            written.push_back({ entry, slot, report });
+    }
 
-BLStatus NvPayloadUpdate::WriteToPartition(std::vector<Entry>& entry_table,
-                                           FILE* blob_file) {
-    BLStatus status = kSuccess;
+    status = CommitPhase();
+    if (status)
+        return status;
 
-    for (auto entry : entry_table) {
-        if (entry.type != kDependPartition) {
-            status = (entry.write)(std::addressof(entry), blob_file, target_slot);
-            if (status) {
-                LOG(INFO) << entry.partition
-                    << " fail to write ";
-                return status;
-            }
+    /*
+     * Read back while they were written or not, entries are only done once
+     * what is on the media after the sync matches
+     */
+    for (size_t i = 0; i < written.size(); i++) {
+        auto& [entry, slot, report] = written[i];
+
+        entry_report_ = report;
+        if (VerifiedPartition(entry, blob_file, slot)) {
+            LOG(ERROR) << "Failed to write " << entry->partition;
+            journal_.Checkpoint(entry->table_index, slot, 0);
+            return kInternalError;
         }
+        journal_.Complete(entry->table_index, slot);
+
+        // Its slots are next to each other
+        if (i + 1 == written.size() || std::get<0>(written[i + 1]) != entry)
+            ReleaseRead(entry);
     }
 
     status = WriteToDependPartition(entry_table, blob_file);
@@ -508,36 +1443,407 @@ BLStatus NvPayloadUpdate::WriteToPartition(std::vector<Entry>& entry_table,
     return status;
 }
 
-void NvPayloadUpdate::ParseHeaderInfo(unsigned char* buffer,
+/*
+ * Reads a little-endian 32-bit field and advances buffer. The caller has
+ * checked that the field is within bounds.
+ */
+template <typename T>
+static inline T ReadField(const unsigned char*& buffer) {
+    T value;
+
+    std::memcpy(&value, buffer, sizeof(value));
+    buffer += sizeof(value);
+    return value;
+}
+
+bool NvPayloadUpdate::ParseHeaderInfo(const unsigned char* buffer, size_t len,
                                       Header* header) {
+    if (len < HEADER_LEN_WO_RATCHET)
+        return false;
+
     std::memcpy(header->magic, buffer, (sizeof(header->magic)-1));
 
     // blob header magic string does not have null terminator
     header->magic[sizeof(header->magic)-1] = '\0';
     buffer += sizeof(header->magic)-1;
 
-    std::memcpy( &header->hex, buffer, sizeof(int));
-    buffer += sizeof(int);
+    header->hex = ReadField<uint32_t>(buffer);
+    header->size = ReadField<uint32_t>(buffer);
+    header->header_size = ReadField<uint32_t>(buffer);
+    header->number_of_elements = ReadField<uint32_t>(buffer);
+    header->type = ReadField<uint32_t>(buffer);
+    header->uncomp_size = ReadField<uint32_t>(buffer);
 
-    std::memcpy( &header->size, buffer, sizeof(int));
-    buffer += sizeof(int);
+    if (header->type == UPDATE_TYPE) {
+        if (len < HEADER_LEN_WO_RATCHET + sizeof(RatchetInfo))
+            return false;
+        header->ratchet_info = ReadField<RatchetInfo>(buffer);
+    }
 
-    std::memcpy( &header->header_size, buffer, sizeof(int));
-    buffer += sizeof(int);
+    return header->header_size <= header->size;
+}
 
-    std::memcpy( &header->number_of_elements, buffer, sizeof(int));
-    buffer += sizeof(int);
+size_t NvPayloadUpdate::EntryLength(Header* header) {
+    if (strncmp(header->magic, UPDATE_MAGIC_V2, UPDATE_MAGIC_SIZE) == 0)
+        return ENTRY_LEN_WO_SPEC + IMG_SPEC_INFO_LENGTH_V2;
+    if (strncmp(header->magic, UPDATE_MAGIC_V3, UPDATE_MAGIC_SIZE) == 0)
+        return ENTRY_LEN_WO_SPEC + IMG_SPEC_INFO_LENGTH_V3;
 
-    std::memcpy( &header->type, buffer, sizeof(int));
-    buffer += sizeof(int);
+    return 0;
+}
 
-    std::memcpy( &header->uncomp_size, buffer, sizeof(int));
-    buffer += sizeof(int);
+bool NvPayloadUpdate::ResolvePayloads(std::vector<Entry>& entry_table,
+                                      FILE* blob_file, Header* header) {
+    /*
+     * Blobs with compressed entries carry the total uncompressed size in
+     * the header. Otherwise it is zero or the blob size, and entries are
+     * taken as they are, even if one happens to start with a frame magic.
+     */
+    bool compressed = header->uncomp_size &&
+                      header->uncomp_size != header->size;
+
+    for (auto& entry : entry_table) {
+        uint64_t size = entry.len;
+
+        entry.codec = kCodecNone;
+        if (compressed &&
+            !ProbePayload(fileno(blob_file), entry.pos, entry.len,
+                          &entry.codec, &size)) {
+            LOG(ERROR) << entry.partition << " has an unsupported compressed frame";
+            return false;
+        }
 
-    if (header->type == UPDATE_TYPE) {
-        std::memcpy( &header->ratchet_info, buffer, sizeof(RatchetInfo));
-        buffer += sizeof(RatchetInfo);
+        if (size > UINT32_MAX) {
+            LOG(ERROR) << entry.partition << " is too large: " << size;
+            return false;
+        }
+        entry.size = size;
+    }
+
+    return true;
+}
+
+// Size of the block device or file at path, false if it can not be told
+static bool PartitionSize(const std::string& path, uint64_t* size) {
+    struct stat st;
+
+    if (stat(path.c_str(), &st))
+        return false;
+
+    if (S_ISREG(st.st_mode)) {
+        *size = st.st_size;
+        return true;
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    bool ok = !ioctl(fd, BLKGETSIZE64, size);
+    close(fd);
+
+    return ok;
+}
+
+/*
+ * The uncompressed size of a payload is only known from its frame, so it
+ * is checked against every partition it goes to before anything is
+ * written. A user partition that can not be found fails when it is
+ * opened instead.
+ */
+bool NvPayloadUpdate::PayloadsFit(std::vector<Entry>& entry_table) {
+    for (auto& entry : entry_table) {
+        // Depend partitions are written to both slots
+        std::vector<int> slots = entry.type == kDependPartition ?
+                                 std::vector<int>{ 0, 1 } : TargetSlots();
+
+        for (int slot : slots) {
+            std::string path;
+            uint64_t size = 0;
+
+            if (entry.type == kUserPartition) {
+                path = UserPartitionPath(&entry, slot);
+                if (!PartitionSize(path, &size))
+                    continue;
+            } else {
+                path = config_.boot_part;
+                size = boot_gpt_.GetSize(entry.index[slot]);
+            }
+
+            if (entry.size > size) {
+                LOG(ERROR) << entry.partition << " payload of " << entry.size
+                    << " bytes does not fit in " << size << " bytes of "
+                    << path << " for slot " << slot;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool NvPayloadUpdate::LoadDigests(const char* ota_path, FILE* blob_file,
+                                  Header* header,
+                                  std::vector<uint8_t>& digests) {
+    std::string sidecar = std::string(ota_path) + DIGEST_SIDECAR_SUFFIX;
+    FILE* manifest = blob_file;
+    char magic[DIGEST_MAGIC_SIZE];
+    uint32_t count = 0;
+    bool ok = false;
+
+    fseek(blob_file, header->size, SEEK_SET);
+    if (fread(magic, 1, sizeof(magic), blob_file) != sizeof(magic) ||
+        memcmp(magic, DIGEST_MAGIC, DIGEST_MAGIC_SIZE) != 0) {
+        manifest = fopen(sidecar.c_str(), "r");
+        if (!manifest) {
+            LOG(WARNING) << "No digest manifest, payload integrity is not checked";
+            return true;
+        }
+
+        if (fread(magic, 1, sizeof(magic), manifest) != sizeof(magic) ||
+            memcmp(magic, DIGEST_MAGIC, DIGEST_MAGIC_SIZE) != 0) {
+            LOG(ERROR) << sidecar << " is not a digest manifest";
+            goto exit;
+        }
+    }
+
+    if (fread(&count, 1, sizeof(count), manifest) != sizeof(count) ||
+        count != header->number_of_elements) {
+        LOG(ERROR) << "Digest manifest has " << count << " entries, blob has "
+            << header->number_of_elements;
+        goto exit;
+    }
+
+    digests.resize((size_t) count * SHA256_DIGEST_LENGTH);
+    ok = fread(digests.data(), 1, digests.size(), manifest) == digests.size();
+    if (!ok)
+        LOG(ERROR) << "Digest manifest is truncated";
+
+exit:
+    if (manifest != blob_file)
+        fclose(manifest);
+
+    return ok;
+}
+
+void NvPayloadUpdate::AccountRead(PayloadStream& stream) {
+    uint64_t bytes_read, read_us;
+
+    stream.Stats(&bytes_read, &read_us);
+    entry_report_->bytes_read += bytes_read;
+    entry_report_->read_us += read_us;
+}
+
+/*
+ * Depend entries are read back before and after they are written, and
+ * other entries are read more than once when they share their range or
+ * image with another entry or are scheduled more than once. The payloads
+ * of those are read into the cache in full. One found by its digest was
+ * checked against it when it was read.
+ */
+PayloadCache::Data NvPayloadUpdate::CachedPayload(Entry *entry_table,
+                                                  FILE* blob_file) {
+    const uint8_t* digest = config_.read_cache_digest ? entry_table->digest :
+                            nullptr;
+    uint8_t actual[SHA256_DIGEST_LENGTH];
+    const char* data;
+    ssize_t bytes;
+
+    if (!read_cache_.Fits(entry_table->size) ||
+        !(entry_table->repeated || entry_table->type == kDependPartition ||
+          blob_schedule_.Pending(entry_table->pos, entry_table->len) > 1))
+        return nullptr;
+
+    PayloadCache::Data cached = read_cache_.Find(entry_table->pos,
+                                                 entry_table->len, digest);
+    if (cached)
+        return cached;
+
+    PayloadStream stream(fileno(blob_file), entry_table->pos, entry_table->len,
+                         entry_table->codec, entry_table->size,
+                         buffer_pool_.size(), config_.pipeline_depth,
+                         read_engine_.get());
+    auto payload = std::make_shared<std::vector<char>>();
+
+    payload->reserve(entry_table->size);
+    if (digest)
+        stream.EnableDigest();
+
+    while ((bytes = stream.Next(&data)) > 0)
+        payload->insert(payload->end(), data, data + bytes);
+
+    // Left to be read again by the caller, which reports what is wrong
+    if (bytes < 0 || payload->size() != entry_table->size)
+        return nullptr;
+    if (digest && (!stream.Digest(actual) ||
+                   memcmp(actual, digest, sizeof(actual)) != 0))
+        return nullptr;
+
+    AccountRead(stream);
+    read_cache_.Put(entry_table->pos, entry_table->len, digest, payload);
+
+    return payload;
+}
+
+std::unique_ptr<PayloadStream> NvPayloadUpdate::OpenStream(Entry *entry_table,
+                                                           FILE* blob_file) {
+    PayloadCache::Data cached = CachedPayload(entry_table, blob_file);
+
+    if (cached)
+        return std::make_unique<PayloadStream>(cached, buffer_pool_.size());
+
+    return std::make_unique<PayloadStream>(fileno(blob_file), entry_table->pos,
+                                           entry_table->len, entry_table->codec,
+                                           entry_table->size, buffer_pool_.size(),
+                                           config_.pipeline_depth,
+                                           read_engine_.get());
+}
+
+// An entry that shares its image with others stays cached for them
+void NvPayloadUpdate::ReleaseRead(Entry *entry_table) {
+    if (blob_schedule_.Release(entry_table->pos, entry_table->len) &&
+        !entry_table->repeated)
+        read_cache_.Erase(entry_table->pos, entry_table->len);
+}
+
+bool NvPayloadUpdate::CheckDigest(Entry *entry_table, PayloadStream& stream) {
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+
+    if (!entry_table->digest)
+        return true;
+
+    if (!stream.Digest(digest) ||
+        memcmp(digest, entry_table->digest, sizeof(digest)) != 0) {
+        LOG(ERROR) << entry_table->partition << " payload digest mismatch";
+        return false;
     }
+
+    return true;
+}
+
+// Hashes an entry without writing it anywhere
+bool NvPayloadUpdate::CheckPayloadDigest(Entry *entry_table, FILE* blob_file) {
+    std::unique_ptr<PayloadStream> stream;
+    const char* data;
+    ssize_t bytes;
+
+    if (!entry_table->digest)
+        return true;
+
+    stream = OpenStream(entry_table, blob_file);
+    stream->EnableDigest();
+    while ((bytes = stream->Next(&data)) > 0)
+        ;
+
+    return !bytes && CheckDigest(entry_table, *stream);
+}
+
+bool NvPayloadUpdate::ReadPayload(Entry *entry_table, FILE* blob_file,
+                                  char* buffer) {
+    std::unique_ptr<PayloadStream> stream = OpenStream(entry_table, blob_file);
+    const char* data;
+    ssize_t bytes;
+
+    if (entry_table->digest)
+        stream->EnableDigest();
+
+    while ((bytes = stream->Next(&data)) > 0) {
+        memcpy(buffer, data, bytes);
+        buffer += bytes;
+    }
+
+    if (bytes < 0) {
+        LOG(ERROR) << entry_table->partition << " payload could not be read";
+        return false;
+    }
+
+    AccountRead(*stream);
+    return CheckDigest(entry_table, *stream);
+}
+
+/*
+ * The payload is hashed on the stream's own thread while it is written.
+ * A mismatch fails the entry, and with it the update before any boot
+ * chain partition is touched, so a bad payload is never committed.
+ *
+ * With a journal, the stream is synced and checkpointed as it goes. A
+ * resumed entry is still read and hashed from the start, but the part
+ * that is already on the media of a target is not written to it again.
+ */
+BLStatus NvPayloadUpdate::StreamPayload(Entry *entry_table, FILE* blob_file,
+                                        std::deque<SlotTarget>& targets,
+                                        uint64_t* written) {
+    std::unique_ptr<PayloadStream> payload = OpenStream(entry_table, blob_file);
+    uint64_t resume = UINT64_MAX;
+    uint64_t checkpoint;
+    const char* data;
+    ssize_t bytes;
+
+    if (entry_table->digest)
+        payload->EnableDigest();
+
+    for (auto& target : targets) {
+        target.resume = journal_.Progress(entry_table->table_index, target.slot);
+        if (target.resume) {
+            LOG(INFO) << entry_table->partition << " resuming " << target.path
+                << " after " << target.resume << " bytes";
+        }
+        resume = std::min(resume, target.resume);
+    }
+    checkpoint = resume + JOURNAL_CHECKPOINT_SIZE;
+
+    *written = 0;
+    while ((bytes = payload->Next(&data)) > 0) {
+        {
+            ScopedTimer timer(&entry_report_->write_us);
+
+            for (auto& target : targets) {
+                size_t skip = std::min<uint64_t>(
+                    target.resume - std::min(target.resume, *written), bytes);
+
+                if ((skip && !target.writer.Skip(skip)) ||
+                    !target.writer.Write(data + skip, bytes - skip)) {
+                    PLOG(ERROR) << entry_table->partition << " write to "
+                        << target.path << " failed";
+                    return kInternalError;
+                }
+                target.report->bytes_written += bytes - skip;
+            }
+        }
+        *written += bytes;
+
+        if (journal_.IsOpen() && *written >= checkpoint &&
+            *written < entry_table->size) {
+            for (auto& target : targets) {
+                // Only targets that got past their recorded progress
+                if (*written > target.resume && !SyncStream(target.writer))
+                    journal_.Checkpoint(entry_table->table_index, target.slot,
+                                        *written);
+            }
+            checkpoint = *written + JOURNAL_CHECKPOINT_SIZE;
+        }
+    }
+
+    if (bytes < 0) {
+        LOG(ERROR) << entry_table->partition << " payload could not be read";
+        return kInternalError;
+    }
+
+    {
+        ScopedTimer timer(&entry_report_->write_us);
+
+        for (auto& target : targets) {
+            if (!target.writer.Flush()) {
+                PLOG(ERROR) << entry_table->partition << " write to "
+                    << target.path << " failed";
+                return kInternalError;
+            }
+            target.report->bytes_zeroed += target.writer.zeroed();
+        }
+    }
+    AccountRead(*payload);
+
+    return CheckDigest(entry_table, *payload) ? kSuccess : kInternalError;
 }
 
 std::string NvPayloadUpdate::GetDeviceTNSpec() {
@@ -569,44 +1875,58 @@ uint8_t NvPayloadUpdate::GetDeviceOpMode() {
     return 1;
 }
 
-void NvPayloadUpdate::ParseEntryTable(char* buffer, std::vector<Entry>& entry_table,
-                                      Header* header) {
-    int num_entries = header->number_of_elements;
+// View of a fixed-size, NUL-padded string field
+static inline std::string_view FieldView(const char* field, size_t len) {
+    std::string_view view(field, len);
+
+    return view.substr(0, view.find('\0'));
+}
+
+bool NvPayloadUpdate::ParseEntryTable(const char* buffer, size_t len,
+                                      std::vector<Entry>& entry_table,
+                                      Header* header,
+                                      std::vector<Entry>* skipped) {
+    size_t num_entries = header->number_of_elements;
+    size_t entry_len = EntryLength(header);
     Entry temp_entry;
     std::string tnspec = GetDeviceTNSpec();
 
     // Device op_mode is 0 or 1, but corresponds to 1 and 2 in a BUP entry
     uint8_t op_mode = GetDeviceOpMode() + 1;
 
-    // Check spec length
-    uint8_t spec_len = IMG_SPEC_INFO_LENGTH_V2;
-    if (strncmp(header->magic, UPDATE_MAGIC_V3, UPDATE_MAGIC_SIZE) == 0)
-        spec_len = IMG_SPEC_INFO_LENGTH_V3;
+    if (!entry_len || len / entry_len < num_entries)
+        return false;
+
+    entry_table.reserve(num_entries);
 
-    for (int i = 0; i < num_entries; i++) {
-        temp_entry.partition.assign(buffer, PARTITION_LEN);
-        temp_entry.partition.erase(std::find(temp_entry.partition.begin(),
-                                             temp_entry.partition.end(), '\0'),
-                                   temp_entry.partition.end());
-        buffer+= (PARTITION_LEN)*sizeof(char);
+    for (size_t i = 0; i < num_entries; i++) {
+        const char* field = buffer + i * entry_len;
+        const unsigned char* words;
 
-        std::memcpy(&temp_entry.pos, buffer, sizeof(int32_t));
-        buffer+= sizeof(int32_t);
+        temp_entry.type = kUserPartition;
+        temp_entry.write = &NvPayloadUpdate::WriteToUserPartition;
+        temp_entry.codec = kCodecNone;
 
-        std::memcpy(&temp_entry.len, buffer, sizeof(int32_t));
-        buffer+= sizeof(int32_t);
+        temp_entry.table_index = i;
+        temp_entry.digest = nullptr;
+        temp_entry.repeated = false;
+        temp_entry.partition = FieldView(field, PARTITION_LEN);
+        words = reinterpret_cast<const unsigned char*>(field + PARTITION_LEN);
 
-        std::memcpy(&temp_entry.version, buffer, sizeof(int32_t));
-        buffer+= sizeof(int32_t);
+        temp_entry.pos = ReadField<uint32_t>(words);
+        temp_entry.len = ReadField<uint32_t>(words);
+        temp_entry.version = ReadField<uint32_t>(words);
+        temp_entry.op_mode = ReadField<uint32_t>(words);
 
-        std::memcpy(&temp_entry.op_mode, buffer, sizeof(int32_t));
-        buffer+= sizeof(int32_t);
+        temp_entry.spec_info = FieldView(reinterpret_cast<const char*>(words),
+                                         entry_len - ENTRY_LEN_WO_SPEC);
 
-        temp_entry.spec_info.assign(buffer, spec_len);
-        temp_entry.spec_info.erase(std::find(temp_entry.spec_info.begin(),
-                                             temp_entry.spec_info.end(), '\0'),
-                                   temp_entry.spec_info.end());
-        buffer+= (spec_len)*sizeof(char);
+        if ((uint64_t) temp_entry.pos + temp_entry.len > header->size) {
+            LOG(ERROR) << "Entry " << temp_entry.partition << " ("
+                << temp_entry.pos << ", " << temp_entry.len
+                << ") is outside of the blob";
+            return false;
+        }
 
         // Conditions for a valid entry:
         // - Entry tnspec is empty
@@ -616,26 +1936,26 @@ void NvPayloadUpdate::ParseEntryTable(char* buffer, std::vector<Entry>& entry_ta
         // - Entry op_mode is 2 and device op_mode is 1
         // Otherwise, ignore the entry
         if (!((temp_entry.spec_info.empty() ||
-               tnspec.compare(temp_entry.spec_info) == 0) &&
+               temp_entry.spec_info.compare(tnspec) == 0) &&
               (temp_entry.op_mode == 0 ||
-               temp_entry.op_mode == op_mode)))
+               temp_entry.op_mode == op_mode))) {
+            if (skipped) {
+                temp_entry.size = temp_entry.len;
+                skipped->push_back(temp_entry);
+            }
             continue;
+        }
 
-        std::string part_match = temp_entry.partition;
-        if ((part_match.compare("BCT")) != 0 && target_slot)
-            part_match += "_b";
-
-        if (BootGPT.MatchPartition(part_match, &temp_entry.index)) {
+        if (MatchBootPartition(&temp_entry)) {
             temp_entry.type = (IsDependPartition(temp_entry.partition) ? 
                                kDependPartition : kBootPartition);
-            temp_entry.write = WriteToBootPartition;
-        } else {
-            temp_entry.type = kUserPartition;
-            temp_entry.write = WriteToUserPartition;
+            temp_entry.write = &NvPayloadUpdate::WriteToBootPartition;
         }
 
-	entry_table.push_back(temp_entry);
+        entry_table.push_back(temp_entry);
     }
+
+    return true;
 }
 
 void NvPayloadUpdate::PrintHeader(Header* header) {
@@ -649,21 +1969,15 @@ void NvPayloadUpdate::PrintHeader(Header* header) {
 
 void NvPayloadUpdate::PrintEntryTable(std::vector<Entry>& entry_table, Header* header) {
     LOG(INFO) << "ENTRY_TABLE:";
-    LOG(INFO) << "PART  POS  LEN  VER TYPE";
+    LOG(INFO) << "PART  POS  LEN  VER TYPE  CODEC  SIZE";
 
-    for (auto entry : entry_table) {
+    for (const auto& entry : entry_table) {
         LOG(INFO) << entry.partition << "  "
                 << entry.pos << "  "
                 << entry.len << "  "
                 << entry.version << "  "
-                << static_cast<int>(entry.type);
+                << static_cast<int>(entry.type) << "  "
+                << PayloadCodecName(entry.codec) << "  "
+                << entry.size;
     }
 }
-
-int main() {
-    NvPayloadUpdate updater;
-
-    BLStatus status = updater.UpdateDriver();
-
-    return status;
-}
@@ -12,33 +12,68 @@
 #define T186_NV_BOOTLOADER_PAYLOAD_UPDATER_H_
 
 #include <bootctrl_nvidia.h>
+#include <nv_bup_format.h>
+#include "bct_plan.h"
+#include "blob_schedule.h"
+#include "device_geometry.h"
+#include "gpt/gpttegra.h"
+#include "io_engine.h"
+#include "partition_writer.h"
+#include "payload_cache.h"
+#include "payload_stream.h"
+#include "rate_limiter.h"
+#include "update_journal.h"
+#include "update_report.h"
+#include <android-base/logging.h>
 #include <hardware/boot_control.h>
 
 #include <stdio.h>
+#include <deque>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <fstream>
+#include <utility>
 #include <vector>
 
-#define UPDATE_TYPE 0
-#define BMP_TYPE 1
-
-#define UPDATE_MAGIC_V2 "NVIDIA__BLOB__V2"
-#define UPDATE_MAGIC_V3 "NVIDIA__BLOB__V3"
-#define UPDATE_MAGIC_SIZE 17
-#define ENTRY_LEN_WO_SPEC 56
-#define IMG_SPEC_INFO_LENGTH_V2 64
-#define IMG_SPEC_INFO_LENGTH_V3 128
-
 #define PARTITION_PATH "/dev/block/by-name/"
 #define BP_ENABLE_PATH "/sys/block/mmcblk0boot0/force_ro"
-#define PARTITION_LEN 40
 
 #define BMP_PATH "/postinstall/system/etc/firmware/bmp.blob"
 #define BLOB_PATH "/postinstall/system/etc/firmware/bl_update_payload"
 
 #define BMP_NAME "bootlogo"
 
+/*
+ * Progress of an interrupted update is kept here, so the next run resumes
+ * it. Partially written entries are synced and checkpointed every
+ * JOURNAL_CHECKPOINT_SIZE bytes.
+ */
+#define JOURNAL_PATH "/metadata/ota/nv_bootloader_payload.journal"
+#define JOURNAL_CHECKPOINT_SIZE (4 * 1024 * 1024)
+// Journal slot of an update that writes both slots
+#define JOURNAL_BOTH_SLOTS 2
+
+/*
+ * A verification run records the entries it found intact here, so one
+ * that is cut short goes on with the next entry. It reads at idle I/O
+ * priority and sleeps to keep its CPU time within VERIFY_CPU_PERCENT of
+ * the time it runs.
+ */
+#define VERIFY_JOURNAL_PATH "/metadata/ota/nv_bootloader_verify.journal"
+#define VERIFY_CPU_PERCENT 25
+
+/*
+ * Rough sustained rates used to estimate durations in a dry-run plan.
+ * Verification reads everything back once more.
+ */
+#define PLAN_EMMC_WRITE_BPS (20 * 1024 * 1024)
+#define PLAN_QSPI_WRITE_BPS (512 * 1024)
+#define PLAN_USER_WRITE_BPS (40 * 1024 * 1024)
+#define PLAN_VERIFY_BPS (100 * 1024 * 1024)
+
 /* Compute ceil(n/d) */
 #define DIV_CEIL(n, d) (((n) + (d) - 1) / (d))
 
@@ -47,10 +82,10 @@
 
 
 /*
- * TODO : read those value from block device
- *
+ * BootROM geometry of the boot device, by its kind. What BootROM assumes
+ * can not be read from the device, except that an eMMC page is never
+ * smaller than a logical block.
  */
-#define BCT_MAX_COPIES 64
 #define BR_EMMC_BLOCK_SIZE (16 * 1024)
 #define BR_EMMC_PAGE_SIZE 512
 #define BR_QSPI_BLOCK_SIZE (32 * 1024)
@@ -61,13 +96,6 @@ struct DependPartition {
     int slot;
 };
 
-DependPartition part_dependence[] = {
-    { "mb1", 0 },
-    { "BCT", 0 },
-    { "BCT", 1 },
-    { "mb1", 1 },
-};
-
 enum PartitionType {
     kBootPartition = 0,
     kUserPartition,
@@ -81,12 +109,56 @@ enum BLStatus{
    kFsOpenFailed,
    kInternalError,
    kSlotOpenFailed,
+   kVerifyMismatch,
    kStatusMax
 };
 
+/*
+ * Where an update reads its payloads from and writes them to. The default
+ * constructor fills it from the system properties and the paths above;
+ * tests and benchmarks can point everything at files instead.
+ */
+struct UpdaterConfig {
+    std::string blob_path = BLOB_PATH;
+    std::string bmp_path = BMP_PATH;
+    std::string partition_path = PARTITION_PATH;
+    std::string bp_enable_path = BP_ENABLE_PATH;
+    std::string journal_path = JOURNAL_PATH;   // empty to not journal
+    std::string verify_journal_path = VERIFY_JOURNAL_PATH;
+    unsigned verify_cpu_percent = VERIFY_CPU_PERCENT;  // 0 for no limit
+    bool direct_io = true;      // write partitions around the page cache
+    bool elide_zeroes = true;   // zero or punch all-zero chunks instead
+    // Chunks are read, written and read back in a pipeline of this depth
+    size_t chunk_size = WRITE_CHUNK_SIZE;
+    size_t pipeline_depth = WRITE_PIPELINE_DEPTH;
+    // Reads or writes in flight on each device, through io_uring if it
+    // is allowed and available and through a thread pool otherwise
+    size_t io_depth = IO_QUEUE_DEPTH;
+    bool io_uring = true;
+    // Payloads read more than once are kept in memory up to this size,
+    // 0 to read them from the blob every time. With read_cache_digest,
+    // entries whose payloads have the same SHA-256 share one read too.
+    size_t read_cache_size = READ_CACHE_SIZE;
+    bool read_cache_digest = true;
+    // Budget of the writes to each disk, so the foreground keeps its
+    // storage latency during an update, and overrides of it by disk
+    // name, e.g. mmcblk0
+    RateLimit write_limit;
+    std::map<std::string, RateLimit> device_write_limits;
+    std::string boot_part;
+    std::string gpt_part;
+    // Geometry of boot_part that replaces what is probed, e.g. for tests
+    std::string geometry_path;
+    uint8_t target_slot = 1;
+    // Writes every entry to both slots from a single read of the payload,
+    // e.g. to provision a device; target_slot is then ignored
+    bool both_slots = false;
+};
+
 class NvPayloadUpdate {
  public:
     NvPayloadUpdate();
+    explicit NvPayloadUpdate(const UpdaterConfig& config);
     ~NvPayloadUpdate();
 
     /* UpdateDriver - main function that parses the Bootloader
@@ -96,6 +168,26 @@ class NvPayloadUpdate {
      */
     BLStatus UpdateDriver();
 
+    /* PlanDriver - parses the payloads like UpdateDriver and prints the
+     * writes it would do, in order, as JSON. No device is written.
+     * @params - out, stream the plan is printed to
+     * @return - 0 on success, non-zero otherwise.
+     */
+    BLStatus PlanDriver(std::ostream& out);
+
+    /* VerifyDriver - reads back the partitions of the unused slots in
+     * the background and compares them with the payload. No device is
+     * written.
+     * @return - 0 if all of them match, kVerifyMismatch if any does not,
+     * another non-zero status if they could not be checked.
+     */
+    BLStatus VerifyDriver();
+
+    /* PrintReport - prints the per-partition timings of the last
+     * UpdateDriver or VerifyDriver run as JSON.
+     */
+    void PrintReport(std::ostream& out);
+
  private:
     struct RatchetInfo {
         uint8_t mb1_ratchet_level;
@@ -116,61 +208,253 @@ class NvPayloadUpdate {
         struct RatchetInfo ratchet_info;
     };
 
+    /*
+     * Partition name and spec point into the entry table buffer read
+     * from the blob, which must outlive the entries.
+     */
     struct Entry{
-        std::string partition;
+        std::string_view partition;
         uint32_t pos;
         uint32_t len;
         uint32_t version;
         uint32_t op_mode;
-        std::string spec_info;
+        std::string_view spec_info;
+        PayloadCodec codec;
+        uint32_t size;          // uncompressed payload size
+        uint32_t table_index;   // position in the blob entry table
+        const uint8_t* digest;  // expected SHA-256 of the payload, or null
+        bool repeated;          // another entry has its range or digest
         PartitionType type;
-	uint8_t index;
-        BLStatus (*write)(Entry*, FILE*, int);
+        uint8_t index[2];       // GPT index of the partition of each slot
+        BLStatus (NvPayloadUpdate::*write)(Entry*, FILE*, int);
+    };
+
+    // A parsed OTA blob. Entries point into table_buf and digests.
+    struct Payload {
+        FILE* blob_file = nullptr;
+        Header header;
+        std::vector<char> table_buf;
+        std::vector<Entry> entry_table;
+        std::vector<Entry> skipped;
+        std::vector<uint8_t> digests;
+
+        ~Payload() {
+            if (blob_file)
+                fclose(blob_file);
+        }
     };
 
+    struct PlanStep {
+        Entry* entry;
+        int slot;
+        std::string path;
+        uint64_t offset;
+        uint64_t bytes;
+        const char* action;
+        const char* reason;
+        uint64_t estimated_ms;
+    };
+
+    // A slot an entry is streamed to, and the record its writes go to
+    struct SlotTarget {
+        SlotTarget(int target_slot, EntryReport* entry_report,
+                   AlignedBufferPool* pool, IoEngine* engine)
+            : slot(target_slot), report(entry_report), writer(pool, engine) {}
+
+        int slot;
+        EntryReport* report;
+        std::string path;
+        uint64_t offset = 0;
+        uint64_t resume = 0;    // payload bytes already on the media
+        PartitionWriter writer;
+    };
+
+    /*
+     * Devices written in the current update phase. Writes are not synced
+     * one by one; each device is synced once when the phase is committed,
+     * and the boot device stays writable until then.
+     */
+    struct PhaseDevice {
+        std::string path;
+        int fd;
+    };
+
+    BLStatus OpenPayload(const char* ota_path, Payload* payload);
+    // Identifies the payload a journal belongs to
+    bool PayloadId(Payload* payload, uint8_t id[SHA256_DIGEST_LENGTH]);
+
+    // Lists the writes of an update in the order WriteToPartition does them
+    void BuildPlan(Payload* payload, std::vector<PlanStep>& plan);
+
+    void Init(const UpdaterConfig& config);
+    // Sizes the buffers and creates the I/O engines on first use
+    void SetUpIo();
+    // Probes the boot device geometry on first use and applies the
+    // override file
+    void LoadBootGeometry();
+    // Reads the boot device GPT on first use, false if there is none
+    bool LoadBootGpt();
+    // Finds the boot device partitions of an entry, false if there are none
+    bool MatchBootPartition(Entry* entry);
+    // The slots the entries of the payload are written to
+    std::vector<int> TargetSlots() const;
+
     // Updates the partitions in ota.blob
-    static BLStatus OTAUpdater(const char* ota_path);
+    BLStatus OTAUpdater(const char* ota_path);
 
     // Updates BMP-A/BMP-B with bmp.blob
-    static BLStatus BMPUpdater(const char* bmp_path);
+    BLStatus BMPUpdater(const char* bmp_path);
 
     static std::string GetDeviceTNSpec();
     static uint8_t GetDeviceOpMode();
 
-    // Parses header in the payload
-    static void ParseHeaderInfo(unsigned char* buffer, Header* header);
-    static void ParseEntryTable(char* buffer, std::vector<Entry>& entry_table,
+    // Parses header in the payload, false if buffer is too short
+    static bool ParseHeaderInfo(const unsigned char* buffer, size_t len,
                                 Header* header);
-
-    static bool IsDependPartition(std::string partition);
-    static void GetEntryTable(std::string part, Entry *entry_t,
-                              std::vector<Entry>& entry_table);
+    // Parses and filters the entry table, false if it does not fit the blob
+    bool ParseEntryTable(const char* buffer, size_t len,
+                         std::vector<Entry>& entry_table,
+                         Header* header,
+                         std::vector<Entry>* skipped = nullptr);
+    static size_t EntryLength(Header* header);
+    // Detects compressed entries and their uncompressed size
+    bool ResolvePayloads(std::vector<Entry>& entry_table,
+                         FILE* blobfile, Header* header);
+
+    // False if a payload is larger than a partition it is written to
+    bool PayloadsFit(std::vector<Entry>& entry_table);
+
+    // Loads the digest manifest, false if one exists but is invalid
+    bool LoadDigests(const char* ota_path, FILE* blobfile,
+                     Header* header, std::vector<uint8_t>& digests);
+    bool CheckDigest(Entry *entry_table, PayloadStream& stream);
+    bool CheckPayloadDigest(Entry *entry_table, FILE* blobfile);
+
+    // Reads the whole uncompressed payload of an entry into buffer
+    bool ReadPayload(Entry *entry_table, FILE* blobfile, char* buffer);
+    // Writes the uncompressed payload of an entry at the stream position
+    // of each target, skipping what the journal says is already on the media
+    BLStatus StreamPayload(Entry *entry_table, FILE* blobfile,
+                           std::deque<SlotTarget>& targets,
+                           uint64_t* written);
+    // Adds the read statistics of a stream to the current entry
+    void AccountRead(PayloadStream& stream);
+    // Stream of the payload of an entry, served from the read cache if
+    // the entry is read more than once
+    std::unique_ptr<PayloadStream> OpenStream(Entry *entry_table,
+                                              FILE* blobfile);
+    // Reads a payload in full into the read cache, null if it is not kept
+    PayloadCache::Data CachedPayload(Entry *entry_table, FILE* blobfile);
+    // Ends a scheduled read of an entry, and drops its payload from the
+    // read cache after the last one
+    void ReleaseRead(Entry *entry_table);
+
+    static bool IsDependPartition(std::string_view partition);
+    static Entry* GetEntryTable(std::string_view part,
+                                std::vector<Entry>& entry_table);
 
     // Writes to unused slot partitions from the payload
-    static BLStatus WriteToPartition(std::vector<Entry>& entry_table, FILE* blobfile);
-
-    static BLStatus WriteToUserPartition(Entry *entry_table,
-                                         FILE* blobfile,
-                                         int slot);
-    static BLStatus WriteToDependPartition(std::vector<Entry>& entry_table,
-                                           FILE* blobfile);
-
-    static BLStatus WriteToBootPartition(Entry *entry_table,
-                                         FILE* blobfile, int slot);
-
-    static BLStatus EnableBootPartitionWrite(int enable);
-
-    static BLStatus WriteToBctPartition(Entry *entry_table,
-                                        FILE *blob_file,
-                                        FILE *bootp,
-                                        int slot);
-
-
-    static int VerifiedPartition(Entry *entry_table, FILE *blob_file, int slot);
+    BLStatus WriteToPartition(std::vector<Entry>& entry_table, FILE* blobfile);
+
+    BLStatus WriteToUserPartition(Entry *entry_table,
+                                  FILE* blobfile,
+                                  int slot);
+    BLStatus WriteToDependPartition(std::vector<Entry>& entry_table,
+                                    FILE* blobfile);
+
+    BLStatus WriteToBootPartition(Entry *entry_table,
+                                  FILE* blobfile, int slot);
+
+    // Streams an entry to its partition of each of slots at once. Each
+    // slot comes with the report its writes are accounted to.
+    BLStatus WriteToSlots(Entry *entry_table, FILE* blobfile,
+                          const std::vector<std::pair<int, EntryReport*>>& slots);
+
+    BLStatus EnableBootPartitionWrite(int enable);
+    // Makes the boot device writable and opens it once for all boot
+    // entries written after. Does nothing if the session is open.
+    BLStatus OpenBootSession();
+    // Closes the boot device and makes it read-only again
+    void CloseBootSession();
+    // Limiter of the disk path is on, nullptr if its writes are not limited
+    RateLimiter* WriteLimiter(const std::string& path);
+
+    // Pushes the writes of a single stream down to the media right away
+    int SyncStream(FILE* stream);
+    int SyncStream(PartitionWriter& writer);
+
+    // Hands a descriptor with all writes issued over to the current phase
+    int AddToPhase(const std::string& path, int written_fd);
+    // Syncs every device written since the last commit, once each
+    BLStatus CommitPhase();
+
+    BLStatus WriteToBctPartition(Entry *entry_table,
+                                 FILE *blob_file,
+                                 int boot_fd,
+                                 int slot);
+
+    int OffsetOfBootPartition(std::string_view part, int slot, uint8_t index);
+
+    // Non-dependent entries in the order they are written: boot entries
+    // by their offset on the boot device, then user partitions
+    std::vector<Entry*> WriteOrder(std::vector<Entry>& entry_table);
+    // Depend entries in blob order, for their payloads to be checked
+    std::vector<Entry*> DependEntries(std::vector<Entry>& entry_table);
+    // Lists the blob reads WriteToPartition is going to do
+    void ScheduleReads(std::vector<Entry>& entry_table, FILE* blobfile);
+
+    std::string UserPartitionPath(Entry *entry_table, int slot);
+    std::string TargetPath(Entry *entry_table, int slot);
+    static const char* SkipReason(Entry *entry_table, const std::string& tnspec);
+
+    BLStatus VerifiedPartition(Entry *entry_table, FILE *blob_file, int slot,
+                               const CpuBudget* budget = nullptr,
+                               android::base::LogSeverity severity = android::base::ERROR);
+
+    // Compares the entry payload with what is on the media at offset,
+    // within budget if there is one. Returns kSuccess when they match,
+    // kVerifyMismatch on a mismatch, which is logged at severity, another
+    // status if the media or payload could not be read.
+    BLStatus VerifyPartitionData(const std::string& path, uint64_t offset,
+                                 Entry *entry_table, FILE *blob_file,
+                                 const CpuBudget* budget = nullptr,
+                                 android::base::LogSeverity severity = android::base::ERROR);
 
     // Log parsing of payload
     static void PrintHeader(Header* header);
-    static void PrintEntryTable(std::vector<Entry>& entry_table, Header* header);
+    void PrintEntryTable(std::vector<Entry>& entry_table, Header* header);
+
+    UpdaterConfig config_;
+    GPTDataTegra boot_gpt_;
+    bool gpt_loaded_ = false;
+    bool geometry_loaded_ = false;
+    DeviceGeometry boot_geometry_;
+    uint32_t br_block_size_ = BR_EMMC_BLOCK_SIZE;
+    uint32_t br_page_size_ = BR_EMMC_PAGE_SIZE;
+
+    UpdateReport report_;
+    UpdateJournal journal_;
+    // Write and readback buffers, shared by all entries
+    AlignedBufferPool buffer_pool_{WRITE_CHUNK_SIZE};
+    // Blob reads go through one engine, partition writes through the
+    // others, one for each slot written at once
+    std::unique_ptr<IoEngine> read_engine_;
+    std::unique_ptr<IoEngine> write_engines_[2];
+    // By disk, created as the disks are first written
+    std::map<std::string, std::unique_ptr<RateLimiter>> write_limiters_;
+
+    // Record of the entry being written, so the I/O paths can account for it
+    EntryReport scratch_report_;
+    EntryReport* entry_report_ = &scratch_report_;
+
+    // Blob ranges still to be read, for readahead and cache dropping
+    BlobSchedule blob_schedule_;
+    PayloadCache read_cache_;
+
+    std::vector<PhaseDevice> phase_devices_;
+    bool boot_unlocked_ = false;
+    // Boot device descriptors, shared by every boot entry of the session
+    DeviceFiles boot_files_;
 };
 
 #endif  // T186_NV_BOOTLOADER_PAYLOAD_UPDATER_H_
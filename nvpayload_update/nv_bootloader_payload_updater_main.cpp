@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2016 NVIDIA Corporation.  All rights reserved.
+ *
+ * NVIDIA Corporation and its licensors retain all intellectual property
+ * and proprietary rights in and to this software and related documentation
+ * and any modifications thereto.  Any use, reproduction, disclosure or
+ * distribution of this software and related documentation without an express
+ * license agreement from NVIDIA Corporation is strictly prohibited.
+ */
+
+#include "nv_bootloader_payload_updater.h"
+#include <android-base/logging.h>
+#include <string.h>
+#include <fstream>
+#include <iostream>
+
+int main(int argc, char* argv[]) {
+    NvPayloadUpdate updater;
+    const char* report_path = nullptr;
+    bool verify = false;
+    BLStatus status;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--plan"))
+            return updater.PlanDriver(std::cout);
+        else if (!strcmp(argv[i], "--verify"))
+            verify = true;
+        else if (!strcmp(argv[i], "--report") && i + 1 < argc)
+            report_path = argv[++i];
+    }
+
+    status = verify ? updater.VerifyDriver() : updater.UpdateDriver();
+
+    if (report_path) {
+        std::ofstream report(report_path);
+        updater.PrintReport(report);
+        if (!report)
+            LOG(WARNING) << "Report could not be written to " << report_path;
+    }
+
+    return status;
+}
@@ -0,0 +1,658 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "partition_writer.h"
+
+#include <android-base/logging.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "update_report.h"
+
+AlignedBufferPool::~AlignedBufferPool() {
+    for (char* buffer : free_)
+        free(buffer);
+}
+
+char* AlignedBufferPool::Get() {
+    std::lock_guard<std::mutex> lock(mu_);
+    void* buffer;
+
+    if (!free_.empty()) {
+        char* reused = free_.back();
+        free_.pop_back();
+        return reused;
+    }
+
+    if (posix_memalign(&buffer, DIRECT_IO_ALIGN, size_))
+        return nullptr;
+
+    return static_cast<char*>(buffer);
+}
+
+void AlignedBufferPool::Put(char* buffer) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    free_.push_back(buffer);
+}
+
+void AlignedBufferPool::Resize(size_t size) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    if (size == size_)
+        return;
+
+    for (char* buffer : free_)
+        free(buffer);
+    free_.clear();
+    size_ = size;
+}
+
+std::vector<char*> AlignedBufferPool::Reserve(size_t count) {
+    std::lock_guard<std::mutex> lock(mu_);
+    void* buffer;
+
+    while (free_.size() < count &&
+           !posix_memalign(&buffer, DIRECT_IO_ALIGN, size_))
+        free_.push_back(static_cast<char*>(buffer));
+
+    return free_;
+}
+
+/*
+ * Checks a buffer for zeros a block of words at a time. The inner loop has
+ * no branches, so the compiler vectorizes it; the outer one stops at the
+ * first block with a set bit.
+ */
+static bool IsZero(const char* data, size_t len) {
+    const size_t block = 32;
+    size_t words = len / sizeof(uint64_t);
+
+    for (size_t i = 0; i < words; i += block) {
+        size_t end = std::min(words, i + block);
+        uint64_t bits = 0;
+
+        for (size_t j = i; j < end; j++) {
+            uint64_t word;
+
+            memcpy(&word, data + j * sizeof(word), sizeof(word));
+            bits |= word;
+        }
+        if (bits)
+            return false;
+    }
+
+    for (size_t i = words * sizeof(uint64_t); i < len; i++) {
+        if (data[i])
+            return false;
+    }
+
+    return true;
+}
+
+static ssize_t PreadFull(int fd, char* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t bytes = pread(fd, buf + done, len - done, offset + done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (!bytes)
+            break;
+        done += bytes;
+    }
+
+    return done;
+}
+
+bool DeviceFiles::Open(const std::string& device, bool want_direct,
+                       const DeviceGeometry* geo) {
+    Close();
+
+    path = device;
+    geometry = geo ? *geo : DeviceGeometry();
+    if (!geo)
+        ProbeDeviceGeometry(path, &geometry);
+
+    if (want_direct) {
+        fd = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        direct = fd >= 0;
+    }
+
+    // Not asked for, or refused
+    if (fd < 0 && (!want_direct || errno == EINVAL))
+        fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    if (direct) {
+        buffered_fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+        verify_fd = open(path.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+        if (buffered_fd < 0) {
+            // Heads and tails have to go through fd then
+            int flags = fcntl(fd, F_GETFL);
+
+            if (flags < 0 || fcntl(fd, F_SETFL, flags & ~O_DIRECT) < 0) {
+                Close();
+                return false;
+            }
+            direct = false;
+        }
+    }
+
+    return true;
+}
+
+void DeviceFiles::Close() {
+    for (int* file : { &fd, &buffered_fd, &verify_fd }) {
+        if (*file >= 0)
+            close(*file);
+        *file = -1;
+    }
+    direct = false;
+}
+
+PartitionWriter::PartitionWriter(AlignedBufferPool* pool, IoEngine* engine)
+    : pool_(pool), engine_(engine) {
+    IoRequest idle = {};
+
+    if (engine_) {
+        writes_.assign(engine_->depth(), idle);
+        started_.assign(engine_->depth(), 0);
+    }
+}
+
+PartitionWriter::~PartitionWriter() {
+    Close();
+}
+
+bool PartitionWriter::Open(const std::string& path, uint64_t offset,
+                           bool direct) {
+    Close();
+
+    if (!own_files_.Open(path, direct))
+        return false;
+
+    return Open(&own_files_, offset);
+}
+
+bool PartitionWriter::Open(DeviceFiles* files, uint64_t offset) {
+    Close();
+
+    path_ = files->path;
+    pos_ = offset;
+    fill_ = 0;
+    direct_ = files->direct;
+    direct_done_ = false;
+    zero_method_ = kZeroWrite;
+    zeroed_ = 0;
+    files_ = files;
+    fd_ = files->fd;
+    buffered_fd_ = files->buffered_fd;
+
+    // Full chunks only stay aligned if they are a multiple of it
+    align_ = files->geometry.WriteAlign(DIRECT_IO_ALIGN);
+    if (pool_->size() % align_)
+        align_ = DIRECT_IO_ALIGN;
+
+    if (direct_) {
+        buf_ = pool_->Get();
+        if (!buf_ && !DropDirect()) {
+            Close();
+            return false;
+        }
+    }
+
+    if (engine_)
+        engine_->RegisterFile(fd_);
+
+    return true;
+}
+
+void PartitionWriter::EnableReadback(size_t depth) {
+    if (!direct_ || verifying_)
+        return;
+
+    verify_fd_ = files_->verify_fd;
+    if (verify_fd_ < 0)
+        return;
+
+    depth_ = std::max<size_t>(depth, 1);
+    verifying_ = true;
+    failed_ = false;
+    stop_ = false;
+    verifier_ = std::thread(&PartitionWriter::Verify, this);
+}
+
+void PartitionWriter::EnableZeroElision() {
+    struct stat st;
+    uint64_t size;
+
+    if (!direct_ || fstat(fd_, &st))
+        return;
+
+    if (S_ISBLK(st.st_mode) && !ioctl(fd_, BLKGETSIZE64, &size)) {
+        zero_method_ = kZeroBlock;
+        end_ = size;
+    } else if (S_ISREG(st.st_mode)) {
+        zero_method_ = kZeroPunch;
+        end_ = st.st_size;
+    }
+}
+
+bool PartitionWriter::Write(const char* data, size_t len) {
+    if (!direct_) {
+        Throttle(len);
+        if (!WriteBuffered(data, len, pos_))
+            return false;
+        pos_ += len;
+        return true;
+    }
+
+    while (len) {
+        size_t bytes;
+
+        if (!fill_ && pos_ % align_) {
+            // Up to the next aligned block
+            bytes = std::min<size_t>(len, align_ - pos_ % align_);
+            Throttle(bytes);
+            if (!WriteBuffered(data, bytes, pos_))
+                return false;
+        } else {
+            bytes = std::min(len, pool_->size() - fill_);
+            memcpy(buf_ + fill_, data, bytes);
+            fill_ += bytes;
+        }
+
+        data += bytes;
+        len -= bytes;
+        pos_ += bytes;
+
+        if (fill_ == pool_->size()) {
+            if (!ZeroChunk(fill_, pos_ - fill_))
+                return false;
+            fill_ = 0;
+        }
+    }
+
+    return true;
+}
+
+bool PartitionWriter::Skip(uint64_t len) {
+    if (!Flush())
+        return false;
+
+    pos_ += len;
+    return true;
+}
+
+bool PartitionWriter::Flush() {
+    size_t aligned = fill_ - fill_ % align_;
+    uint64_t start = pos_ - fill_;
+
+    if (fill_) {
+        // Before buf_ is handed over with the aligned part
+        if (fill_ > aligned) {
+            Throttle(fill_ - aligned);
+            if (!WriteBuffered(buf_ + aligned, fill_ - aligned, start + aligned))
+                return false;
+        }
+
+        if (aligned && !ZeroChunk(aligned, start))
+            return false;
+
+        fill_ = 0;
+    }
+
+    return WaitWrites() && (!verifying_ || Drain());
+}
+
+void PartitionWriter::Close() {
+    // Writes that failed half way are still in flight
+    while (engine_ && engine_->in_flight()) {
+        IoRequest* req = engine_->Reap();
+
+        if (!req)
+            break;
+        pool_->Put(req->data);
+        req->data = nullptr;
+    }
+
+    if (verifier_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mu_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        verifier_.join();
+    }
+
+    for (Readback& readback : pending_)
+        pool_->Put(readback.data);
+    pending_.clear();
+    verifying_ = false;
+
+    verify_fd_ = -1;
+
+    if (buf_)
+        pool_->Put(buf_);
+    buf_ = nullptr;
+
+    if (fd_ >= 0 && engine_)
+        engine_->UnregisterFile(fd_);
+    if (files_ == &own_files_)
+        own_files_.Close();
+    buffered_fd_ = -1;
+    fd_ = -1;
+    files_ = nullptr;
+}
+
+bool PartitionWriter::WriteChunk(size_t len, uint64_t offset) {
+    if (engine_) {
+        while (engine_->full()) {
+            if (!Complete())
+                return false;
+        }
+
+        auto req = std::find_if(writes_.begin(), writes_.end(),
+                                [](const IoRequest& r) { return !r.data; });
+
+        Throttle(len);
+        started_[req - writes_.begin()] = NowUs();
+        req->fd = fd_;
+        req->data = buf_;
+        req->len = len;
+        req->offset = offset;
+        req->write = true;
+        if (!engine_->Submit(&*req)) {
+            req->data = nullptr;
+            return false;
+        }
+    } else {
+        Throttle(len);
+        uint64_t start = NowUs();
+        if (!WriteDirect(buf_, len, offset))
+            return false;
+        if (limiter_)
+            limiter_->Observe(NowUs() - start);
+        return HandOver(len, offset);
+    }
+
+    buf_ = pool_->Get();
+    if (!buf_) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+bool PartitionWriter::ZeroChunk(size_t len, uint64_t offset) {
+    uint64_t range[2] = { offset, len };
+    int ret = -1;
+
+    // Past the end the range has to be written, to grow a file
+    if (zero_method_ == kZeroWrite || offset + len > end_ ||
+        !IsZero(buf_, len))
+        return WriteChunk(len, offset);
+
+    if (zero_method_ == kZeroBlock) {
+        Throttle(len);
+        uint64_t start = NowUs();
+        ret = ioctl(fd_, BLKZEROOUT, range);
+        if (!ret && limiter_)
+            limiter_->Observe(NowUs() - start);
+    } else {
+        off_t data = lseek(fd_, offset, SEEK_DATA);
+
+        if ((data < 0 && errno == ENXIO) ||
+            (data >= 0 && (uint64_t) data >= offset + len))
+            ret = 0;
+        else
+            ret = fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                            offset, len);
+    }
+
+    if (ret) {
+        if (errno != EOPNOTSUPP && errno != ENOTTY && errno != EINVAL &&
+            errno != ENXIO)
+            return false;
+
+        LOG(INFO) << "Writing zeros to " << path_ << " as data: "
+            << strerror(errno);
+        zero_method_ = kZeroWrite;
+        return WriteChunk(len, offset);
+    }
+
+    zeroed_ += len;
+
+    // buf_ holds just what the range reads back as now
+    return HandOver(len, offset);
+}
+
+bool PartitionWriter::HandOver(size_t len, uint64_t offset) {
+    // Still ours unless readback needs it
+    if (!verifying_ || !direct_)
+        return true;
+    if (!Submit(buf_, len, offset))
+        return false;
+
+    buf_ = pool_->Get();
+    if (!buf_) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    return true;
+}
+
+bool PartitionWriter::Complete() {
+    IoRequest* req = engine_->Reap();
+
+    if (!req) {
+        errno = EIO;
+        return false;
+    }
+
+    char* data = req->data;
+    ssize_t result = req->result;
+    bool ok = true;
+
+    req->data = nullptr;
+    if (limiter_ && result >= 0)
+        limiter_->Observe(NowUs() - started_[req - writes_.data()]);
+
+    // Some file systems accept O_DIRECT at open but not our alignment
+    if (result == -EINVAL && !direct_done_ && (!direct_ || DropDirect())) {
+        ok = WriteBuffered(data, req->len, req->offset);
+    } else if (result < 0) {
+        errno = -result;
+        ok = false;
+    } else {
+        direct_done_ = true;
+        // Readback takes the buffer over
+        if (verifying_ && direct_) {
+            if (Submit(data, req->len, req->offset))
+                return true;
+            ok = false;
+        }
+    }
+
+    pool_->Put(data);
+    return ok;
+}
+
+void PartitionWriter::Throttle(size_t len) {
+    if (limiter_)
+        limiter_->Acquire(len);
+}
+
+// Waits until the engine wrote everything queued
+bool PartitionWriter::WaitWrites() {
+    while (engine_ && engine_->in_flight()) {
+        if (!Complete())
+            return false;
+    }
+
+    return true;
+}
+
+bool PartitionWriter::WriteDirect(const char* data, size_t len,
+                                  uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t bytes = pwrite(fd_, data + done, len - done, offset + done);
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+
+        // Some file systems accept O_DIRECT at open but not our alignment
+        if (bytes < 0 && errno == EINVAL && !done && DropDirect())
+            return WriteBuffered(data, len, offset);
+
+        if (bytes <= 0)
+            return false;
+        done += bytes;
+    }
+
+    return true;
+}
+
+bool PartitionWriter::WriteBuffered(const char* data, size_t len,
+                                    uint64_t offset) {
+    int fd = direct_ ? buffered_fd_ : fd_;
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t bytes = pwrite(fd, data + done, len - done, offset + done);
+
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return false;
+        if (!bytes) {
+            errno = ENOSPC;
+            return false;
+        }
+        done += bytes;
+    }
+
+    return true;
+}
+
+// Switches to writing through the page cache
+bool PartitionWriter::DropDirect() {
+    int flags = fcntl(fd_, F_GETFL);
+
+    if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0)
+        return false;
+
+    // Other writers of the descriptor now write buffered too
+    files_->direct = false;
+    direct_ = false;
+    return true;
+}
+
+bool PartitionWriter::Submit(char* data, size_t len, uint64_t offset) {
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+
+        cv_.wait(lock, [this] {
+            return pending_.size() + busy_ < depth_ || failed_;
+        });
+        if (failed_) {
+            errno = EIO;
+            return false;
+        }
+
+        pending_.push_back({ data, len, offset });
+    }
+    cv_.notify_all();
+
+    return true;
+}
+
+// Waits until everything queued was read back
+bool PartitionWriter::Drain() {
+    std::unique_lock<std::mutex> lock(mu_);
+
+    cv_.wait(lock, [this] {
+        return (pending_.empty() && !busy_) || failed_;
+    });
+    if (failed_) {
+        errno = EIO;
+        return false;
+    }
+
+    return true;
+}
+
+void PartitionWriter::Verify() {
+    char* source = pool_->Get();
+
+    while (true) {
+        Readback readback;
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+
+            cv_.wait(lock, [this] { return stop_ || !pending_.empty(); });
+            if (stop_)
+                break;
+
+            readback = pending_.front();
+            pending_.pop_front();
+            busy_ = true;
+        }
+
+        ssize_t bytes = source ? PreadFull(verify_fd_, source, readback.len,
+                                           readback.offset) : -1;
+        size_t got = bytes > 0 ? bytes : 0;
+        bool match = got == readback.len &&
+                     !memcmp(source, readback.data, got);
+
+        if (!match) {
+            size_t i = 0;
+
+            while (i < got && source[i] == readback.data[i])
+                i++;
+            LOG(ERROR) << "Readback of " << path_ << " does not match at "
+                << readback.offset + i;
+        }
+
+        pool_->Put(readback.data);
+
+        std::lock_guard<std::mutex> lock(mu_);
+        busy_ = false;
+        failed_ |= !match;
+        cv_.notify_all();
+    }
+
+    if (source)
+        pool_->Put(source);
+}
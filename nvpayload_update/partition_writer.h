@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_PARTITION_WRITER_H_
+#define NV_PARTITION_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "device_geometry.h"
+#include "io_engine.h"
+#include "rate_limiter.h"
+
+/*
+ * Direct I/O goes around the page cache, so buffers and device offsets
+ * are aligned to the largest logical block size we expect on a boot
+ * device. Writes to a device that reports a larger minimum I/O or erase
+ * size are aligned to that instead.
+ */
+#define DIRECT_IO_ALIGN 4096
+#define WRITE_CHUNK_SIZE (1024 * 1024)
+#define WRITE_PIPELINE_DEPTH 2
+
+/*
+ * Aligned buffers of one size, kept for reuse across entries instead of
+ * being allocated for each of them.
+ */
+class AlignedBufferPool {
+ public:
+    explicit AlignedBufferPool(size_t size) : size_(size) {}
+    ~AlignedBufferPool();
+
+    // Returns nullptr if no buffer could be allocated
+    char* Get();
+    void Put(char* buffer);
+    size_t size() const { return size_; }
+    // Changes the buffer size. No buffer may be in use.
+    void Resize(size_t size);
+    // Allocates up to count buffers ahead and returns the idle ones, e.g.
+    // to register them for I/O
+    std::vector<char*> Reserve(size_t count);
+
+    // A buffer that goes back to the pool when it goes out of scope
+    class Buffer {
+     public:
+        explicit Buffer(AlignedBufferPool* pool) : pool_(pool), data_(pool->Get()) {}
+        ~Buffer() { if (data_) pool_->Put(data_); }
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
+
+        char* data() const { return data_; }
+
+     private:
+        AlignedBufferPool* pool_;
+        char* data_;
+    };
+
+ private:
+    size_t size_;
+    std::mutex mu_;
+    std::vector<char*> free_;
+};
+
+/*
+ * A device opened once for a session of writers, which borrow these
+ * descriptors instead of opening it themselves.
+ */
+struct DeviceFiles {
+    ~DeviceFiles() { Close(); }
+
+    // Returns false with errno set if path could not be opened. The
+    // geometry of path is probed unless one is given.
+    bool Open(const std::string& path, bool direct,
+              const DeviceGeometry* geo = nullptr);
+    void Close();
+    bool is_open() const { return fd >= 0; }
+
+    std::string path;
+    int fd = -1;            // O_DIRECT unless direct is false
+    int buffered_fd = -1;   // for unaligned heads and tails
+    int verify_fd = -1;     // O_DIRECT readback, if the device allows it
+    bool direct = false;
+    DeviceGeometry geometry;
+};
+
+/*
+ * Sequential writer for a partition, or a range of a device, starting at
+ * an offset. Data is collected in a pooled buffer and written with
+ * O_DIRECT in aligned chunks. A head or tail that does not cover a whole
+ * aligned block goes through the page cache instead. Devices or files
+ * that refuse O_DIRECT, at open or at the first write, are written
+ * buffered throughout.
+ *
+ * With an engine, aligned chunks are queued to it and up to its depth of
+ * them are written at once. Without one, each is written in turn.
+ *
+ * With readback enabled, every chunk written with O_DIRECT is read back
+ * and compared on a separate thread while the next chunks are written.
+ * Up to depth chunks are in flight. A mismatch fails the next write, so
+ * the update stops early; it is no proof of what is on the media after
+ * the sync.
+ *
+ * With zero elision enabled, aligned chunks that are all zero are not
+ * written. A block device is told to zero the range, and a hole is punched
+ * into a regular file unless the range is a hole already. Where neither is
+ * supported, the zeros are written after all.
+ *
+ * With a rate limiter, every write and zeroed range waits for its budget
+ * first, and the time each takes to complete is reported back to it.
+ */
+class PartitionWriter {
+ public:
+    explicit PartitionWriter(AlignedBufferPool* pool, IoEngine* engine = nullptr);
+    ~PartitionWriter();
+
+    // Returns false with errno set if path could not be opened
+    bool Open(const std::string& path, uint64_t offset, bool direct);
+    // Writes through the descriptors of files, which must stay open
+    // until Close
+    bool Open(DeviceFiles* files, uint64_t offset);
+    // Call after Open. Does nothing unless writes are direct.
+    void EnableReadback(size_t depth);
+    // Call after Open. Does nothing unless writes are direct.
+    void EnableZeroElision();
+    // Paces the writes by limiter, which may be shared with other writers
+    // driven by the same thread
+    void SetRateLimiter(RateLimiter* limiter) { limiter_ = limiter; }
+
+    // All return false with errno set on failure
+    bool Write(const char* data, size_t len);
+    // Moves on by len bytes without writing them
+    bool Skip(uint64_t len);
+    // Writes out everything that is still buffered and waits for the
+    // readback of what was written
+    bool Flush();
+
+    void Close();
+
+    int fd() const { return fd_; }
+    bool direct() const { return direct_; }
+    // Bytes of zeros since Open that were not written out as data
+    uint64_t zeroed() const { return zeroed_; }
+
+ private:
+    struct Readback {
+        char* data;
+        size_t len;
+        uint64_t offset;
+    };
+
+    enum ZeroMethod {
+        kZeroWrite = 0,     // write the zeros like any other data
+        kZeroBlock,         // BLKZEROOUT
+        kZeroPunch,         // punch a hole, unless there is one
+    };
+
+    // Writes the start of buf_ and takes the next buffer
+    bool WriteChunk(size_t len, uint64_t offset);
+    // Same for a start of buf_ that is all zero
+    bool ZeroChunk(size_t len, uint64_t offset);
+    // Hands the start of buf_, now on the media, over to readback
+    bool HandOver(size_t len, uint64_t offset);
+    bool WriteDirect(const char* data, size_t len, uint64_t offset);
+    bool WriteBuffered(const char* data, size_t len, uint64_t offset);
+    bool DropDirect();
+    // Waits for the budget of a write of len bytes
+    void Throttle(size_t len);
+    // Takes in the next write completed by the engine
+    bool Complete();
+    bool WaitWrites();
+    // Queues a written buffer for readback, which then owns it
+    bool Submit(char* data, size_t len, uint64_t offset);
+    bool Drain();
+    void Verify();
+
+    AlignedBufferPool* pool_;
+    IoEngine* engine_;
+    std::vector<IoRequest> writes_;     // free while data is null
+    std::vector<uint64_t> started_;     // when each of writes_ was submitted
+    RateLimiter* limiter_ = nullptr;
+    bool direct_done_ = false;  // a direct write went through
+    ZeroMethod zero_method_ = kZeroWrite;
+    uint64_t end_ = 0;          // size of the device or file
+    uint64_t zeroed_ = 0;
+    std::string path_;
+    char* buf_ = nullptr;
+    size_t fill_ = 0;           // bytes in buf_, ending at pos_
+    uint64_t pos_ = 0;          // device offset of the next byte
+    int fd_ = -1;
+    int buffered_fd_ = -1;      // for unaligned heads and tails
+    bool direct_ = false;
+    uint32_t align_ = DIRECT_IO_ALIGN;  // of direct writes
+    DeviceFiles own_files_;     // unless the descriptors are borrowed
+    DeviceFiles* files_ = nullptr;
+
+    int verify_fd_ = -1;
+    size_t depth_ = 0;
+    bool verifying_ = false;
+    std::thread verifier_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Readback> pending_;
+    bool busy_ = false;         // the verifier holds a popped chunk
+    bool stop_ = false;
+    bool failed_ = false;
+};
+
+#endif  // NV_PARTITION_WRITER_H_
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "payload_cache.h"
+
+#include <openssl/sha.h>
+
+#include <iterator>
+
+static std::string DigestKey(const uint8_t* digest) {
+    if (!digest)
+        return std::string();
+
+    return std::string(reinterpret_cast<const char*>(digest),
+                       SHA256_DIGEST_LENGTH);
+}
+
+void PayloadCache::SetBudget(size_t budget) {
+    budget_ = budget;
+    while (used_ > budget_)
+        Evict(std::prev(items_.end()));
+}
+
+PayloadCache::Data PayloadCache::Find(uint64_t pos, uint32_t len,
+                                      const uint8_t* digest) {
+    std::list<Item>::iterator item;
+    auto range = by_range_.find(Range(pos, len));
+
+    if (range != by_range_.end()) {
+        item = range->second;
+    } else {
+        auto same = by_digest_.find(DigestKey(digest));
+
+        if (!digest || same == by_digest_.end())
+            return nullptr;
+        item = same->second;
+    }
+
+    items_.splice(items_.begin(), items_, item);
+    hits_++;
+    saved_bytes_ += len;
+
+    return item->data;
+}
+
+void PayloadCache::Put(uint64_t pos, uint32_t len, const uint8_t* digest,
+                       Data data) {
+    if (!data || !Fits(data->size()))
+        return;
+
+    Erase(pos, len);
+    while (used_ + data->size() > budget_)
+        Evict(std::prev(items_.end()));
+
+    items_.push_front({ Range(pos, len), DigestKey(digest), data });
+    by_range_[items_.front().range] = items_.begin();
+    if (digest)
+        by_digest_[items_.front().digest] = items_.begin();
+    used_ += data->size();
+}
+
+void PayloadCache::Erase(uint64_t pos, uint32_t len) {
+    auto range = by_range_.find(Range(pos, len));
+
+    if (range != by_range_.end())
+        Evict(range->second);
+}
+
+void PayloadCache::Clear() {
+    items_.clear();
+    by_range_.clear();
+    by_digest_.clear();
+    used_ = 0;
+}
+
+void PayloadCache::Evict(std::list<Item>::iterator item) {
+    by_range_.erase(item->range);
+
+    auto same = by_digest_.find(item->digest);
+    if (!item->digest.empty() && same != by_digest_.end() &&
+        same->second == item)
+        by_digest_.erase(same);
+
+    used_ -= item->data->size();
+    items_.erase(item);
+}
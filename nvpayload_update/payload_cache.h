@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_PAYLOAD_CACHE_H_
+#define NV_PAYLOAD_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define READ_CACHE_SIZE (16 * 1024 * 1024)
+
+/*
+ * Uncompressed payloads of blob ranges that are read more than once, so
+ * each is read and decoded from the blob a single time. A payload is
+ * found by its blob range and, if it was checked against one, by its
+ * SHA-256, which lets entries at different ranges with the same image
+ * share it.
+ *
+ * Payloads are dropped least recently used first to stay within the
+ * budget. One still being streamed from is kept alive by its reader, so
+ * memory can go over the budget by the payloads in use.
+ */
+class PayloadCache {
+ public:
+    typedef std::shared_ptr<const std::vector<char>> Data;
+
+    explicit PayloadCache(size_t budget = READ_CACHE_SIZE) : budget_(budget) {}
+
+    void SetBudget(size_t budget);
+    // Whether a payload of size is cached at all
+    bool Fits(uint64_t size) const { return size && size <= budget_; }
+
+    // digest is null for a payload that was not checked against one
+    Data Find(uint64_t pos, uint32_t len, const uint8_t* digest);
+    void Put(uint64_t pos, uint32_t len, const uint8_t* digest, Data data);
+    // Drops the payload of a range that is not going to be read again
+    void Erase(uint64_t pos, uint32_t len);
+    void Clear();
+
+    uint64_t hits() const { return hits_; }
+    // Blob bytes that did not have to be read
+    uint64_t saved_bytes() const { return saved_bytes_; }
+
+ private:
+    typedef std::pair<uint64_t, uint32_t> Range;
+
+    struct Item {
+        Range range;
+        std::string digest;     // empty if not checked
+        Data data;
+    };
+
+    void Evict(std::list<Item>::iterator item);
+
+    size_t budget_;
+    size_t used_ = 0;
+    // Most recently used first
+    std::list<Item> items_;
+    std::map<Range, std::list<Item>::iterator> by_range_;
+    std::map<std::string, std::list<Item>::iterator> by_digest_;
+    uint64_t hits_ = 0;
+    uint64_t saved_bytes_ = 0;
+};
+
+#endif  // NV_PAYLOAD_CACHE_H_
@@ -0,0 +1,467 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "payload_stream.h"
+#include "update_report.h"
+
+#include <android-base/logging.h>
+#include <errno.h>
+#include <lz4frame.h>
+#include <string.h>
+#include <unistd.h>
+#include <zstd.h>
+
+#include <algorithm>
+
+#define ZSTD_FRAME_MAGIC 0xFD2FB528
+#define LZ4_FRAME_MAGIC 0x184D2204
+#define PROBE_LEN 32
+#define COMPRESSED_IN_SIZE (128 * 1024)
+// Smallest piece a chunk read is split into for the engine
+#define READ_REQUEST_MIN (128 * 1024)
+
+static ssize_t PreadFull(int fd, void* buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t bytes = pread(fd, static_cast<char*>(buf) + done, len - done,
+                              offset + done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (!bytes)
+            break;
+        done += bytes;
+    }
+
+    return done;
+}
+
+bool ProbePayload(int fd, uint64_t pos, uint32_t len, PayloadCodec* codec,
+                  uint64_t* size) {
+    unsigned char head[PROBE_LEN];
+    ssize_t bytes = PreadFull(fd, head, std::min<size_t>(len, PROBE_LEN), pos);
+    uint32_t magic = 0;
+
+    *codec = kCodecNone;
+    *size = len;
+
+    if (bytes < 0)
+        return false;
+    if (bytes < (ssize_t) sizeof(magic))
+        return true;
+
+    memcpy(&magic, head, sizeof(magic));
+
+    if (magic == ZSTD_FRAME_MAGIC) {
+        unsigned long long content = ZSTD_getFrameContentSize(head, bytes);
+
+        if (content == ZSTD_CONTENTSIZE_UNKNOWN ||
+            content == ZSTD_CONTENTSIZE_ERROR)
+            return false;
+
+        *codec = kCodecZstd;
+        *size = content;
+    } else if (magic == LZ4_FRAME_MAGIC) {
+        LZ4F_dctx* dctx;
+        LZ4F_frameInfo_t info;
+        size_t src = bytes;
+
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+            return false;
+        size_t ret = LZ4F_getFrameInfo(dctx, &info, head, &src);
+        LZ4F_freeDecompressionContext(dctx);
+
+        if (LZ4F_isError(ret) || !info.contentSize)
+            return false;
+
+        *codec = kCodecLz4;
+        *size = info.contentSize;
+    }
+
+    return true;
+}
+
+const char* PayloadCodecName(PayloadCodec codec) {
+    switch (codec) {
+    case kCodecZstd:
+        return "zstd";
+    case kCodecLz4:
+        return "lz4";
+    default:
+        return "raw";
+    }
+}
+
+PayloadStream::PayloadStream(int fd, uint64_t pos, uint32_t len,
+                             PayloadCodec codec, uint64_t size,
+                             size_t chunk_size, size_t depth,
+                             IoEngine* engine)
+    : fd_(fd), pos_(pos), len_(len), codec_(codec), size_(size),
+      chunk_size_(chunk_size), engine_(engine),
+      chunks_(std::max<size_t>(depth, 1)) {
+    for (Chunk& chunk : chunks_)
+        chunk.data = new char[chunk_size_];
+
+    if (engine_)
+        engine_->RegisterFile(fd_);
+
+    if (codec_ == kCodecZstd) {
+        dctx_ = ZSTD_createDStream();
+        in_buf_.resize(ZSTD_DStreamInSize());
+    } else if (codec_ == kCodecLz4) {
+        LZ4F_dctx* dctx = nullptr;
+        if (!LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION)))
+            dctx_ = dctx;
+        in_buf_.resize(COMPRESSED_IN_SIZE);
+    }
+
+    producer_ = std::thread(&PayloadStream::Produce, this);
+}
+
+PayloadStream::PayloadStream(std::shared_ptr<const std::vector<char>> payload,
+                             size_t chunk_size)
+    : fd_(-1), pos_(0), len_(payload->size()), codec_(kCodecNone),
+      size_(payload->size()), chunk_size_(std::max<size_t>(chunk_size, 1)),
+      engine_(nullptr), payload_(std::move(payload)) {
+}
+
+PayloadStream::~PayloadStream() {
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (producer_.joinable())
+        producer_.join();
+    if (hasher_.joinable())
+        hasher_.join();
+
+    if (engine_)
+        engine_->UnregisterFile(fd_);
+
+    if (codec_ == kCodecZstd)
+        ZSTD_freeDStream(static_cast<ZSTD_DStream*>(dctx_));
+    else if (codec_ == kCodecLz4 && dctx_)
+        LZ4F_freeDecompressionContext(static_cast<LZ4F_dctx*>(dctx_));
+
+    for (Chunk& chunk : chunks_)
+        delete[] chunk.data;
+}
+
+ssize_t PayloadStream::Next(const char** data) {
+    if (payload_) {
+        size_t len = std::min<uint64_t>(chunk_size_, size_ - next_);
+
+        *data = payload_->data() + next_;
+        next_ += len;
+        return len;
+    }
+
+    std::unique_lock<std::mutex> lock(mu_);
+
+    if (held_) {
+        held_ = false;
+        released_++;
+        cv_.notify_all();
+    }
+
+    cv_.wait(lock, [this] { return released_ < filled_ || done_ || error_; });
+
+    if (released_ == filled_)
+        return error_ ? -1 : 0;
+
+    Chunk& chunk = chunks_[released_ % chunks_.size()];
+
+    held_ = true;
+    *data = chunk.data;
+    return chunk.len;
+}
+
+void PayloadStream::EnableDigest() {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    if (hashing_)
+        return;
+
+    // Hashed all at once when asked for
+    if (payload_) {
+        hashing_ = true;
+        return;
+    }
+
+    hashing_ = true;
+    SHA256_Init(&sha_);
+    hasher_ = std::thread(&PayloadStream::Hash, this);
+}
+
+bool PayloadStream::Digest(uint8_t digest[SHA256_DIGEST_LENGTH]) {
+    if (!hashing_)
+        return false;
+
+    if (payload_) {
+        SHA256(reinterpret_cast<const uint8_t*>(payload_->data()), size_,
+               digest);
+        return true;
+    }
+
+    // Already joined if the digest was asked for before
+    if (hasher_.joinable())
+        hasher_.join();
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if (error_ || !done_)
+        return false;
+
+    memcpy(digest, digest_, SHA256_DIGEST_LENGTH);
+    return true;
+}
+
+void PayloadStream::Stats(uint64_t* bytes_read, uint64_t* read_us) {
+    std::lock_guard<std::mutex> lock(mu_);
+
+    if (payload_) {
+        *bytes_read = 0;
+        *read_us = 0;
+        return;
+    }
+
+    *bytes_read = (codec_ == kCodecNone) ? produced_ : consumed_;
+    *read_us = read_us_;
+}
+
+// Oldest chunk still in use by consumer or hasher. Called with mu_ held.
+uint64_t PayloadStream::Released() {
+    return hashing_ ? std::min(released_, hashed_) : released_;
+}
+
+void PayloadStream::Produce() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mu_);
+            cv_.wait(lock, [this] {
+                return stop_ || filled_ - Released() < chunks_.size();
+            });
+            if (stop_)
+                return;
+        }
+
+        Chunk& chunk = chunks_[filled_ % chunks_.size()];
+        uint64_t start = NowUs();
+        ssize_t bytes = Fill(chunk.data, chunk_size_);
+
+        std::lock_guard<std::mutex> lock(mu_);
+        read_us_ += NowUs() - start;
+        if (bytes < 0) {
+            error_ = true;
+        } else if (!bytes) {
+            done_ = true;
+        } else {
+            chunk.len = bytes;
+            filled_++;
+        }
+        cv_.notify_all();
+
+        if (bytes <= 0)
+            return;
+    }
+}
+
+void PayloadStream::Hash() {
+    std::unique_lock<std::mutex> lock(mu_);
+
+    while (true) {
+        cv_.wait(lock, [this] {
+            return stop_ || hashed_ < filled_ || done_ || error_;
+        });
+
+        if (stop_)
+            return;
+
+        if (hashed_ == filled_) {
+            if (done_)
+                SHA256_Final(digest_, &sha_);
+            return;
+        }
+
+        Chunk& chunk = chunks_[hashed_ % chunks_.size()];
+
+        lock.unlock();
+        SHA256_Update(&sha_, chunk.data, chunk.len);
+        lock.lock();
+
+        hashed_++;
+        cv_.notify_all();
+    }
+}
+
+/*
+ * Reads len bytes of the blob at offset. The engine gets them as up to
+ * depth requests at once, which keeps the device queue busy.
+ */
+ssize_t PayloadStream::Read(char* buf, size_t len, uint64_t offset) {
+    if (!engine_)
+        return PreadFull(fd_, buf, len, offset);
+
+    size_t piece = std::max<size_t>(READ_REQUEST_MIN,
+                                    (len + engine_->depth() - 1) / engine_->depth());
+    ssize_t total = 0;
+
+    reads_.clear();
+    for (size_t done = 0; done < len; done += piece) {
+        IoRequest req = {};
+
+        req.fd = fd_;
+        req.data = buf + done;
+        req.len = std::min(piece, len - done);
+        req.offset = offset + done;
+        req.result = -EIO;
+        reads_.push_back(req);
+    }
+
+    // A short read is not an error here, only where it is used
+    engine_->Run(reads_.data(), reads_.size());
+
+    for (const IoRequest& req : reads_) {
+        if (req.result < 0) {
+            errno = -req.result;
+            return -1;
+        }
+        total += req.result;
+        if ((size_t) req.result < req.len)
+            break;
+    }
+
+    return total;
+}
+
+ssize_t PayloadStream::Fill(char* buf, size_t cap) {
+    size_t want = std::min<uint64_t>(cap, size_ - produced_);
+    ssize_t bytes;
+
+    if (!want) {
+        // Everything was produced; compressed frames must end here too
+        if (codec_ != kCodecNone && !Finish()) {
+            LOG(ERROR) << PayloadCodecName(codec_)
+                << " frame is longer than its content size " << size_;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (codec_ == kCodecNone)
+        bytes = Read(buf, want, pos_ + produced_);
+    else
+        bytes = Decode(buf, want);
+
+    if (bytes < 0)
+        return -1;
+
+    if (!bytes) {
+        LOG(ERROR) << "Payload at " << pos_ << " ended after " << produced_
+            << " of " << size_ << " bytes";
+        return -1;
+    }
+
+    produced_ += bytes;
+    return bytes;
+}
+
+// Reads the next piece of compressed input once the current one is used up
+bool PayloadStream::Refill() {
+    size_t want = std::min<uint64_t>(in_buf_.size(), len_ - consumed_);
+    ssize_t bytes = Read(in_buf_.data(), want, pos_ + consumed_);
+
+    if (bytes < 0)
+        return false;
+
+    consumed_ += bytes;
+    in_pos_ = 0;
+    in_len_ = bytes;
+    return true;
+}
+
+ssize_t PayloadStream::Decode(char* buf, size_t cap) {
+    size_t produced = 0;
+
+    if (!dctx_)
+        return -1;
+
+    /*
+     * Decoders may hold back output, so they are called again even once
+     * the input is used up. Stop when a call makes no progress.
+     */
+    while (produced < cap && !frame_done_) {
+        size_t in_before = in_pos_;
+        size_t out_before = produced;
+
+        if (in_pos_ == in_len_ && consumed_ < len_) {
+            if (!Refill())
+                return -1;
+            in_before = in_pos_;
+        }
+
+        if (codec_ == kCodecZstd) {
+            ZSTD_outBuffer out = { buf, cap, produced };
+            ZSTD_inBuffer in = { in_buf_.data(), in_len_, in_pos_ };
+            size_t ret = ZSTD_decompressStream(static_cast<ZSTD_DStream*>(dctx_),
+                                               &out, &in);
+
+            if (ZSTD_isError(ret)) {
+                LOG(ERROR) << "zstd: " << ZSTD_getErrorName(ret);
+                return -1;
+            }
+            in_pos_ = in.pos;
+            produced = out.pos;
+            frame_done_ = !ret;
+        } else {
+            size_t dst = cap - produced;
+            size_t src = in_len_ - in_pos_;
+            size_t ret = LZ4F_decompress(static_cast<LZ4F_dctx*>(dctx_),
+                                         buf + produced, &dst,
+                                         in_buf_.data() + in_pos_, &src,
+                                         nullptr);
+
+            if (LZ4F_isError(ret)) {
+                LOG(ERROR) << "lz4: " << LZ4F_getErrorName(ret);
+                return -1;
+            }
+            in_pos_ += src;
+            produced += dst;
+            frame_done_ = !ret;
+        }
+
+        if (in_pos_ == in_before && produced == out_before)
+            break;
+    }
+
+    return produced;
+}
+
+/*
+ * Consumes what is left of the frame after the last content byte, i.e. the
+ * end mark and checksum. Fails if the frame still has content or is cut.
+ */
+bool PayloadStream::Finish() {
+    char spare;
+
+    if (frame_done_)
+        return true;
+
+    return Decode(&spare, sizeof(spare)) == 0 && frame_done_;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_PAYLOAD_STREAM_H_
+#define NV_PAYLOAD_STREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <openssl/sha.h>
+
+#include "io_engine.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define PAYLOAD_CHUNK_SIZE (1024 * 1024)
+#define PAYLOAD_STREAM_DEPTH 2
+
+enum PayloadCodec {
+    kCodecNone = 0,
+    kCodecZstd,
+    kCodecLz4,
+};
+
+/*
+ * Looks at the start of the blob range [pos, pos + len) for a zstd or LZ4
+ * frame. For a compressed entry, size is set from the frame header, which
+ * must carry the content size. Returns false on a read error or a frame
+ * without content size.
+ */
+bool ProbePayload(int fd, uint64_t pos, uint32_t len, PayloadCodec* codec,
+                  uint64_t* size);
+
+const char* PayloadCodecName(PayloadCodec codec);
+
+/*
+ * Produces the uncompressed payload of a blob range in chunks. Reading and
+ * decompression run on a producer thread that stays at most depth chunks
+ * ahead of the consumer, so memory is bounded by depth * chunk_size plus
+ * the decoder state regardless of the entry size.
+ *
+ * With an engine, each chunk of the blob is read as several requests in
+ * flight at once. The engine must not be used by anything else meanwhile.
+ * Its buffers are not registered, as pinning them for each stream costs
+ * more than it saves.
+ *
+ * A payload that was already read in full can be streamed from memory
+ * instead, in chunks of the same size, with no thread and no reads.
+ */
+class PayloadStream {
+ public:
+    PayloadStream(int fd, uint64_t pos, uint32_t len, PayloadCodec codec,
+                  uint64_t size, size_t chunk_size = PAYLOAD_CHUNK_SIZE,
+                  size_t depth = PAYLOAD_STREAM_DEPTH,
+                  IoEngine* engine = nullptr);
+    PayloadStream(std::shared_ptr<const std::vector<char>> payload,
+                  size_t chunk_size = PAYLOAD_CHUNK_SIZE);
+    ~PayloadStream();
+
+    /*
+     * Waits for the next chunk. Returns its length, 0 once the whole
+     * payload was returned or -1 if it could not be read or decoded. The
+     * chunk stays valid until the following call.
+     */
+    ssize_t Next(const char** data);
+
+    /*
+     * Hashes the payload with SHA-256 on its own thread while the consumer
+     * works on the same chunks. Must be called before the first Next().
+     */
+    void EnableDigest();
+
+    /*
+     * Waits until the whole payload was hashed. Returns false if hashing
+     * was not enabled or the payload could not be read.
+     */
+    bool Digest(uint8_t digest[SHA256_DIGEST_LENGTH]);
+
+    // Blob bytes read and time spent reading and decoding. Complete once
+    // Next() returned 0.
+    void Stats(uint64_t* bytes_read, uint64_t* read_us);
+
+    bool from_memory() const { return payload_ != nullptr; }
+
+ private:
+    struct Chunk {
+        char* data;
+        size_t len;
+    };
+
+    void Produce();
+    void Hash();
+    uint64_t Released();
+    ssize_t Read(char* buf, size_t len, uint64_t offset);
+    ssize_t Fill(char* buf, size_t cap);
+    ssize_t Decode(char* buf, size_t cap);
+    bool Refill();
+    bool Finish();
+
+    int fd_;
+    uint64_t pos_;
+    uint32_t len_;
+    PayloadCodec codec_;
+    uint64_t size_;
+    size_t chunk_size_;
+    IoEngine* engine_;
+
+    // Producer side
+    uint64_t consumed_ = 0;
+    uint64_t produced_ = 0;
+    std::vector<char> in_buf_;
+    size_t in_pos_ = 0;
+    size_t in_len_ = 0;
+    bool frame_done_ = false;
+    void* dctx_ = nullptr;
+    uint64_t read_us_ = 0;
+    std::vector<IoRequest> reads_;
+
+    // Shared between producer, consumer and hasher. Chunk n lives in
+    // chunks_[n % depth] until both consumer and hasher are past it.
+    std::vector<Chunk> chunks_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    uint64_t filled_ = 0;
+    uint64_t released_ = 0;
+    uint64_t hashed_ = 0;
+    bool held_ = false;
+    bool hashing_ = false;
+    bool done_ = false;
+    bool error_ = false;
+    bool stop_ = false;
+    SHA256_CTX sha_;
+    uint8_t digest_[SHA256_DIGEST_LENGTH];
+    std::thread producer_;
+    std::thread hasher_;
+
+    // Streamed from memory
+    std::shared_ptr<const std::vector<char>> payload_;
+    uint64_t next_ = 0;
+};
+
+#endif  // NV_PAYLOAD_STREAM_H_
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "rate_limiter.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "device_geometry.h"
+#include "update_report.h"
+
+RateLimiter::RateLimiter(const RateLimit& limit)
+    : limit_(limit), last_us_(NowUs()) {
+    bytes_.rate = bytes_.max_rate = limit.bytes_per_sec;
+    ops_.rate = ops_.max_rate = limit.ops_per_sec;
+}
+
+// A file is limited with the rest of the file system it is on
+std::string RateLimiter::DeviceOf(const std::string& path) {
+    return SysfsDisk(path);
+}
+
+void RateLimiter::Refill(Bucket& bucket, uint64_t elapsed_us) {
+    if (!bucket.rate)
+        return;
+
+    bucket.tokens = std::min(bucket.rate * RATE_BURST_US / 1e6,
+                             bucket.tokens + bucket.rate * elapsed_us / 1e6);
+}
+
+uint64_t RateLimiter::Due(const Bucket& bucket) const {
+    if (!bucket.rate || bucket.tokens >= 0)
+        return 0;
+
+    return -bucket.tokens * 1e6 / bucket.rate;
+}
+
+void RateLimiter::Acquire(size_t len) {
+    uint64_t now = NowUs();
+
+    Refill(bytes_, now - last_us_);
+    Refill(ops_, now - last_us_);
+    last_us_ = now;
+
+    bytes_.tokens -= len;
+    ops_.tokens -= 1;
+
+    uint64_t due = std::max(Due(bytes_), Due(ops_));
+    if (due) {
+        usleep(due);
+        waited_us_ += due;
+    }
+}
+
+void RateLimiter::Observe(uint64_t latency_us) {
+    if (!limit_.latency_us)
+        return;
+
+    uint64_t now = NowUs();
+    bool slow = latency_us > limit_.latency_us;
+
+    if (slow && now - last_cut_us_ < RATE_CUT_INTERVAL_US)
+        return;
+    if (slow)
+        last_cut_us_ = now;
+
+    for (Bucket* bucket : { &bytes_, &ops_ }) {
+        if (!bucket->max_rate)
+            continue;
+
+        if (slow)
+            bucket->rate = std::max(bucket->rate * 3 / 4,
+                                    bucket->max_rate / RATE_FLOOR_DIVISOR);
+        else
+            bucket->rate = std::min(bucket->rate + bucket->max_rate / 20,
+                                    bucket->max_rate);
+    }
+}
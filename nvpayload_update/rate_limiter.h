@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_RATE_LIMITER_H_
+#define NV_RATE_LIMITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+// Longest a writer may go at full speed after being idle
+#define RATE_BURST_US 100000
+// Rates are not cut below this share of the configured ones
+#define RATE_FLOOR_DIVISOR 16
+// Shortest time between two cuts, so one slow burst cuts once
+#define RATE_CUT_INTERVAL_US 100000
+
+// Write budget of one device. 0 for any of them is no limit.
+struct RateLimit {
+    uint64_t bytes_per_sec = 0;
+    uint32_t ops_per_sec = 0;
+    // Time from submitting a write to taking in its completion that the
+    // rates are adapted to keep under
+    uint32_t latency_us = 0;
+};
+
+/*
+ * Token buckets for the bytes and the requests written to one device.
+ * Each bucket refills at its rate and holds at most RATE_BURST_US of it,
+ * so an idle writer can not go at full speed for longer than that. A
+ * write takes its tokens up front and waits off any debt, so one larger
+ * than the bucket still goes through at the rate.
+ *
+ * With a latency target, completed writes steer the rates: a write that
+ * took longer cuts them by a quarter, at most once per
+ * RATE_CUT_INTERVAL_US and not below a RATE_FLOOR_DIVISOR-th, and
+ * each one that did not adds back a twentieth of the configured rate, up
+ * to it.
+ *
+ * A limiter is used by one thread at a time.
+ */
+class RateLimiter {
+ public:
+    explicit RateLimiter(const RateLimit& limit);
+
+    // Finds the disk path is on, so its partitions share one limiter
+    static std::string DeviceOf(const std::string& path);
+
+    // Waits until a write of len bytes may start
+    void Acquire(size_t len);
+    // Accounts a completed write that took latency_us
+    void Observe(uint64_t latency_us);
+
+    bool adaptive() const { return limit_.latency_us != 0; }
+    // Time Acquire spent waiting so far
+    uint64_t waited_us() const { return waited_us_; }
+
+ private:
+    struct Bucket {
+        double rate = 0;        // tokens per second, 0 for no limit
+        double max_rate = 0;
+        double tokens = 0;
+    };
+
+    void Refill(Bucket& bucket, uint64_t elapsed_us);
+    // Microseconds until the bucket is out of debt
+    uint64_t Due(const Bucket& bucket) const;
+
+    RateLimit limit_;
+    Bucket bytes_;
+    Bucket ops_;
+    uint64_t last_us_;
+    uint64_t last_cut_us_ = 0;
+    uint64_t waited_us_ = 0;
+};
+
+#endif  // NV_RATE_LIMITER_H_
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "bct_plan.h"
+#include "nv_bootloader_payload_updater.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define BCT_SIZE 8192
+#define BCT_PART_SIZE (1024 * 1024)
+
+namespace {
+
+BctGeometry EmmcGeometry() {
+    return { BR_EMMC_BLOCK_SIZE, BR_EMMC_PAGE_SIZE, 512, BCT_PART_SIZE };
+}
+
+BctGeometry QspiGeometry() {
+    return { BR_QSPI_BLOCK_SIZE, BR_QSPI_PAGE_SIZE, 512, 256 * 1024 };
+}
+
+std::vector<uint64_t> Offsets(const std::vector<BctWrite>& plan) {
+    std::vector<uint64_t> offsets;
+
+    for (const BctWrite& write : plan)
+        offsets.push_back(write.offset);
+    return offsets;
+}
+
+}  // namespace
+
+// Slot 1 of block 0 lands and is synced before slot 0 is touched
+TEST(BctPlanTest, EmmcSlot0) {
+    std::vector<BctWrite> plan = PlanBctWrites(EmmcGeometry(), BCT_SIZE, 0);
+
+    ASSERT_EQ(plan.size(), 2u);
+    EXPECT_EQ(plan[0].offset, BCT_SIZE);
+    EXPECT_TRUE(plan[0].barrier);
+    EXPECT_EQ(plan[1].offset, 0u);
+    EXPECT_TRUE(plan[1].barrier);
+}
+
+// One copy in slot 0 of every later block, in search order, up to 64 blocks
+TEST(BctPlanTest, EmmcSlot1) {
+    std::vector<BctWrite> plan = PlanBctWrites(EmmcGeometry(), BCT_SIZE, 1);
+
+    ASSERT_EQ(plan.size(), BCT_MAX_COPIES - 1u);
+    for (size_t i = 0; i < plan.size(); i++) {
+        EXPECT_EQ(plan[i].offset, (i + 1) * BR_EMMC_BLOCK_SIZE);
+        EXPECT_EQ(plan[i].barrier, i + 1 == plan.size());
+    }
+}
+
+// A page larger than the BCT still leaves room for slot 1 of block 0
+TEST(BctPlanTest, QspiSlot0) {
+    std::vector<BctWrite> plan = PlanBctWrites(QspiGeometry(), BCT_SIZE, 0);
+
+    ASSERT_EQ(plan.size(), 2u);
+    EXPECT_EQ(plan[0].offset, BR_QSPI_PAGE_SIZE);
+    EXPECT_TRUE(plan[0].barrier);
+    EXPECT_EQ(plan[1].offset, 0u);
+    EXPECT_TRUE(plan[1].barrier);
+}
+
+// Copies stop at the end of the partition
+TEST(BctPlanTest, QspiSlot1) {
+    std::vector<BctWrite> plan = PlanBctWrites(QspiGeometry(), BCT_SIZE, 1);
+
+    EXPECT_EQ(Offsets(plan),
+              std::vector<uint64_t>({ 32768, 65536, 98304, 131072, 163840,
+                                      196608, 229376 }));
+    ASSERT_FALSE(plan.empty());
+    for (size_t i = 0; i + 1 < plan.size(); i++)
+        EXPECT_FALSE(plan[i].barrier);
+    EXPECT_TRUE(plan.back().barrier);
+}
+
+// A BCT that fills block 0 only goes to slot 0
+TEST(BctPlanTest, QspiNoRoomForSlot1) {
+    std::vector<BctWrite> plan =
+        PlanBctWrites(QspiGeometry(), BR_QSPI_PAGE_SIZE + 1, 0);
+
+    ASSERT_EQ(plan.size(), 1u);
+    EXPECT_EQ(plan[0].offset, 0u);
+    EXPECT_TRUE(plan[0].barrier);
+}
+
+// Offsets are whole logical blocks of the device
+TEST(BctPlanTest, LargeLogicalBlocks) {
+    BctGeometry geo = EmmcGeometry();
+
+    geo.lba_size = 4096;
+    EXPECT_EQ(Offsets(PlanBctWrites(geo, 5000, 0)),
+              std::vector<uint64_t>({ 8192, 0 }));
+}
+
+TEST(BctPlanTest, Execute) {
+    TemporaryFile file;
+    std::vector<char> bct(BCT_SIZE, 'B');
+    std::vector<char> media(BCT_PART_SIZE);
+    std::vector<BctWrite> plan = PlanBctWrites(EmmcGeometry(), BCT_SIZE, 1);
+    uint64_t sync_us = 0;
+
+    ASSERT_EQ(ftruncate(file.fd, BCT_PART_SIZE), 0);
+    ASSERT_EQ(ExecuteBctPlan(file.fd, plan, bct.data(), bct.size(),
+                             &sync_us), 0);
+    ASSERT_EQ(pread(file.fd, media.data(), media.size(), 0),
+              (ssize_t) media.size());
+
+    // Block 0 belongs to slot 0 and is left alone
+    for (size_t i = 0; i < BR_EMMC_BLOCK_SIZE; i++)
+        ASSERT_EQ(media[i], 0) << "at " << i;
+    for (const BctWrite& write : plan) {
+        EXPECT_EQ(std::vector<char>(media.begin() + write.offset,
+                                    media.begin() + write.offset + BCT_SIZE),
+                  bct) << "at " << write.offset;
+    }
+}
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * What is in the page cache is seen through mincore. File systems that
+ * ignore the hints, like tmpfs, skip the tests that depend on them.
+ */
+
+#include "blob_schedule.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vector>
+
+#define MIB (1024 * 1024)
+#define BLOB_SIZE (32 * MIB)
+
+namespace {
+
+class BlobScheduleTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        std::vector<char> data(MIB, 'B');
+
+        page_ = sysconf(_SC_PAGESIZE);
+        for (int i = 0; i < BLOB_SIZE / MIB; i++)
+            ASSERT_EQ(write(file_.fd, data.data(), data.size()), MIB);
+        ASSERT_EQ(fsync(file_.fd), 0);
+    }
+
+    // Drops the blob from the cache, false if the file system keeps it
+    bool Uncache() {
+        posix_fadvise(file_.fd, 0, 0, POSIX_FADV_DONTNEED);
+        return Cached(0, BLOB_SIZE) == 0;
+    }
+
+    // Pages of the range that are in the cache
+    size_t Cached(uint64_t pos, uint64_t len) {
+        uint64_t start = pos - pos % page_;
+        size_t pages = (pos + len - start + page_ - 1) / page_;
+        std::vector<unsigned char> vec(pages);
+        void* map = mmap(nullptr, pages * page_, PROT_READ, MAP_SHARED,
+                         file_.fd, start);
+        size_t cached = 0;
+
+        if (map == MAP_FAILED)
+            return 0;
+        if (!mincore(map, pages * page_, vec.data())) {
+            for (unsigned char page : vec)
+                cached += page & 1;
+        }
+        munmap(map, pages * page_);
+
+        return cached;
+    }
+
+    // Waits a little for readahead to come in
+    size_t CachedSoon(uint64_t pos, uint64_t len) {
+        for (int i = 0; i < 100 && !Cached(pos, len); i++)
+            usleep(10000);
+        return Cached(pos, len);
+    }
+
+    void Read(uint64_t pos, uint64_t len) {
+        std::vector<char> buf(len);
+
+        ASSERT_EQ(pread(file_.fd, buf.data(), len, pos), (ssize_t) len);
+    }
+
+    TemporaryFile file_;
+    uint64_t page_;
+};
+
+}  // namespace
+
+TEST_F(BlobScheduleTest, Release) {
+    BlobSchedule schedule;
+
+    schedule.Reset(-1);
+    schedule.Add(0, MIB);
+    schedule.Add(MIB, MIB);
+    schedule.Add(0, MIB);
+    EXPECT_EQ(schedule.Pending(0, MIB), 2);
+    EXPECT_EQ(schedule.Pending(MIB, MIB), 1);
+
+    schedule.Begin(0, MIB);
+    EXPECT_FALSE(schedule.Release(0, MIB));
+    EXPECT_EQ(schedule.Pending(0, MIB), 1);
+    schedule.Begin(MIB, MIB);
+    EXPECT_TRUE(schedule.Release(MIB, MIB));
+    schedule.Begin(0, MIB);
+    EXPECT_TRUE(schedule.Release(0, MIB));
+    EXPECT_EQ(schedule.Pending(0, MIB), 0);
+
+    // Once is all a range is released
+    EXPECT_FALSE(schedule.Release(0, MIB));
+    EXPECT_FALSE(schedule.Release(2 * MIB, MIB));
+
+    schedule.Reset(-1);
+    EXPECT_EQ(schedule.Pending(MIB, MIB), 0);
+}
+
+// The steps after the one begun are read ahead up to the window
+TEST_F(BlobScheduleTest, Readahead) {
+    BlobSchedule schedule;
+
+    if (!Uncache())
+        GTEST_SKIP() << "the file system keeps the blob cached";
+
+    schedule.Reset(file_.fd, 8 * MIB);
+    schedule.Add(0, 4 * MIB);
+    schedule.Add(8 * MIB, 4 * MIB);
+    schedule.Add(16 * MIB, 4 * MIB);
+    schedule.Add(24 * MIB, 4 * MIB);
+
+    schedule.Begin(0, 4 * MIB);
+    EXPECT_GT(CachedSoon(8 * MIB, 4 * MIB), 0u);
+    EXPECT_GT(CachedSoon(16 * MIB, 4 * MIB), 0u);
+    EXPECT_EQ(Cached(24 * MIB, 4 * MIB), 0u);
+
+    // The window moves on with the steps
+    schedule.Begin(8 * MIB, 4 * MIB);
+    EXPECT_GT(CachedSoon(24 * MIB, 4 * MIB), 0u);
+}
+
+// A range is dropped after its last step, not while a step still needs it
+TEST_F(BlobScheduleTest, DropBehind) {
+    BlobSchedule schedule;
+
+    if (!Uncache())
+        GTEST_SKIP() << "the file system keeps the blob cached";
+
+    schedule.Reset(file_.fd, 0);
+    schedule.Add(0, 4 * MIB);
+    schedule.Add(4 * MIB, 4 * MIB);
+    schedule.Add(0, 4 * MIB);
+
+    schedule.Begin(0, 4 * MIB);
+    Read(0, 4 * MIB);
+    schedule.Release(0, 4 * MIB);
+    EXPECT_GT(Cached(0, 4 * MIB), 0u);
+
+    schedule.Begin(4 * MIB, 4 * MIB);
+    Read(4 * MIB, 4 * MIB);
+    schedule.Release(4 * MIB, 4 * MIB);
+    EXPECT_EQ(Cached(4 * MIB, 4 * MIB), 0u);
+
+    schedule.Begin(0, 4 * MIB);
+    schedule.Release(0, 4 * MIB);
+    EXPECT_EQ(Cached(0, 4 * MIB), 0u);
+}
+
+// A page shared with a range still to be read stays cached
+TEST_F(BlobScheduleTest, SharedPage) {
+    BlobSchedule schedule;
+    uint64_t split = 2 * page_ + page_ / 2;
+
+    if (!Uncache())
+        GTEST_SKIP() << "the file system keeps the blob cached";
+
+    schedule.Reset(file_.fd, 0);
+    schedule.Add(0, split);
+    schedule.Add(split, 2 * page_);
+
+    schedule.Begin(0, split);
+    Read(0, split + 2 * page_);
+    schedule.Release(0, split);
+    EXPECT_EQ(Cached(0, 2 * page_), 0u);
+    EXPECT_EQ(Cached(2 * page_, page_), 1u);
+
+    schedule.Begin(split, 2 * page_);
+    schedule.Release(split, 2 * page_);
+    EXPECT_EQ(Cached(2 * page_, 2 * page_), 0u);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "device_geometry.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace {
+
+bool Override(const std::string& text, DeviceGeometry* geo) {
+    TemporaryFile file;
+
+    if (!android::base::WriteStringToFile(text, file.path))
+        return false;
+    return LoadGeometryOverride(file.path, geo);
+}
+
+}  // namespace
+
+TEST(DeviceGeometryTest, Override) {
+    DeviceGeometry geo;
+
+    ASSERT_TRUE(Override("# eMMC boot partition\n"
+                         "logical_block_size=512\n"
+                         "physical_block_size=4096\n"
+                         "\n"
+                         "minimum_io_size=0x1000\n"
+                         "optimal_io_size=524288\n", &geo));
+    EXPECT_EQ(geo.logical_block_size, 512u);
+    EXPECT_EQ(geo.physical_block_size, 4096u);
+    EXPECT_EQ(geo.min_io_size, 4096u);
+    EXPECT_EQ(geo.optimal_io_size, 524288u);
+    EXPECT_EQ(geo.erase_size, 0u);
+    EXPECT_FALSE(geo.mtd);
+}
+
+// Fields the file does not set keep what was probed
+TEST(DeviceGeometryTest, OverrideSomeFields) {
+    DeviceGeometry geo;
+
+    geo.logical_block_size = 4096;
+    geo.optimal_io_size = 65536;
+    ASSERT_TRUE(Override("mtd=1\nerase_size=65536\noptimal_io_size=0\n", &geo));
+    EXPECT_EQ(geo.logical_block_size, 4096u);
+    EXPECT_EQ(geo.optimal_io_size, 0u);
+    EXPECT_EQ(geo.erase_size, 65536u);
+    EXPECT_TRUE(geo.mtd);
+}
+
+TEST(DeviceGeometryTest, OverrideUnknown) {
+    DeviceGeometry geo;
+
+    EXPECT_FALSE(Override("logical_block_size=512\nsector_size=512\n", &geo));
+    EXPECT_FALSE(Override("logical_block_size 512\n", &geo));
+}
+
+TEST(DeviceGeometryTest, OverrideMissing) {
+    DeviceGeometry geo;
+
+    EXPECT_FALSE(LoadGeometryOverride("/nonexistent/geometry", &geo));
+}
+
+TEST(DeviceGeometryTest, WriteAlign) {
+    DeviceGeometry geo;
+
+    // Nothing known: the floor
+    EXPECT_EQ(geo.WriteAlign(4096), 4096u);
+
+    geo.logical_block_size = 512;
+    geo.physical_block_size = 4096;
+    geo.min_io_size = 16384;
+    EXPECT_EQ(geo.WriteAlign(4096), 16384u);
+    EXPECT_EQ(geo.WriteAlign(65536), 65536u);
+
+    // Sizes that are no power of two, or too large, are not followed
+    geo.min_io_size = 12288;
+    EXPECT_EQ(geo.WriteAlign(4096), 4096u);
+    geo.min_io_size = 2 * GEOMETRY_IO_MAX;
+    EXPECT_EQ(geo.WriteAlign(4096), 4096u);
+
+    // An MTD device is aligned to its erase blocks alone
+    geo.mtd = true;
+    geo.erase_size = 65536;
+    EXPECT_EQ(geo.WriteAlign(4096), 65536u);
+}
+
+TEST(DeviceGeometryTest, WriteChunk) {
+    DeviceGeometry geo;
+
+    EXPECT_EQ(geo.WriteChunk(), 0u);
+    geo.erase_size = 65536;
+    EXPECT_EQ(geo.WriteChunk(), 65536u);
+    geo.optimal_io_size = 524288;
+    EXPECT_EQ(geo.WriteChunk(), 524288u);
+    geo.optimal_io_size = 2 * GEOMETRY_IO_MAX;
+    EXPECT_EQ(geo.WriteChunk(), 0u);
+}
+
+// A file stands in for nothing but the disk it is on
+TEST(DeviceGeometryTest, ProbeFile) {
+    TemporaryFile file;
+    DeviceGeometry geo;
+
+    if (!ProbeDeviceGeometry(file.path, &geo))
+        GTEST_SKIP() << "no sysfs queue for " << file.path;
+    EXPECT_FALSE(geo.mtd);
+    EXPECT_GE(geo.logical_block_size, 512u);
+    EXPECT_FALSE(ProbeDeviceGeometry("/nonexistent/device", &geo));
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_TESTS_GPT_IMAGE_H_
+#define NV_TESTS_GPT_IMAGE_H_
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#define GPT_LBA_SIZE 512
+#define GPT_ENTRY_SIZE 128
+
+struct GptPartition {
+    std::string name;
+    uint64_t offset;    // bytes, a multiple of GPT_LBA_SIZE
+    uint64_t size;
+};
+
+/*
+ * Writes a primary and a backup GPT of num_entries entries, the first of
+ * them holding parts, to a file of disk_size bytes. Like on Tegra boot
+ * devices, the usable range starts at LBA 0. Returns false if the file
+ * could not be written.
+ */
+inline bool WriteGptImage(const std::string& path, uint64_t disk_size,
+                          const std::vector<GptPartition>& parts,
+                          uint32_t num_entries = 128) {
+    struct __attribute__((packed)) Header {
+        char signature[8];
+        uint32_t revision;
+        uint32_t header_size;
+        uint32_t header_crc;
+        uint32_t reserved;
+        uint64_t current_lba;
+        uint64_t backup_lba;
+        uint64_t first_usable_lba;
+        uint64_t last_usable_lba;
+        uint8_t disk_guid[16];
+        uint64_t entries_lba;
+        uint32_t num_entries;
+        uint32_t entry_size;
+        uint32_t entries_crc;
+    };
+
+    struct __attribute__((packed)) Entry {
+        uint8_t type_guid[16];
+        uint8_t unique_guid[16];
+        uint64_t first_lba;
+        uint64_t last_lba;
+        uint64_t attributes;
+        uint16_t name[36];
+    };
+
+    std::vector<Entry> entries(num_entries);
+    uint64_t table_lbas = (num_entries * sizeof(Entry) + GPT_LBA_SIZE - 1) /
+                          GPT_LBA_SIZE;
+    uint64_t last_lba = disk_size / GPT_LBA_SIZE - 1;
+    Header header;
+    int fd;
+    bool ok;
+
+    memset(entries.data(), 0, entries.size() * sizeof(Entry));
+    for (size_t i = 0; i < parts.size() && i < num_entries; i++) {
+        Entry& entry = entries[i];
+
+        memset(entry.type_guid, 0xa5, sizeof(entry.type_guid));
+        memcpy(entry.unique_guid, &i, sizeof(i));
+        entry.first_lba = parts[i].offset / GPT_LBA_SIZE;
+        entry.last_lba = (parts[i].offset + parts[i].size) / GPT_LBA_SIZE - 1;
+        for (size_t c = 0; c < parts[i].name.size() && c < 35; c++)
+            entry.name[c] = parts[i].name[c];
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.signature, "EFI PART", 8);
+    header.revision = 0x00010000;
+    header.header_size = sizeof(header);
+    header.last_usable_lba = last_lba - table_lbas - 1;
+    memset(header.disk_guid, 0x5a, sizeof(header.disk_guid));
+    header.num_entries = num_entries;
+    header.entry_size = sizeof(Entry);
+    header.entries_crc = crc32(0, (const Bytef*) entries.data(),
+                               entries.size() * sizeof(Entry));
+
+    Header primary = header;
+    primary.current_lba = 1;
+    primary.backup_lba = last_lba;
+    primary.entries_lba = 2;
+    primary.header_crc = crc32(0, (const Bytef*) &primary, sizeof(primary));
+
+    Header backup = header;
+    backup.current_lba = last_lba;
+    backup.backup_lba = 1;
+    backup.entries_lba = last_lba - table_lbas;
+    backup.header_crc = crc32(0, (const Bytef*) &backup, sizeof(backup));
+
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+
+    size_t table_len = entries.size() * sizeof(Entry);
+    ok = ftruncate(fd, disk_size) == 0 &&
+         pwrite(fd, &primary, sizeof(primary), GPT_LBA_SIZE) ==
+             (ssize_t) sizeof(primary) &&
+         pwrite(fd, entries.data(), table_len, 2 * GPT_LBA_SIZE) ==
+             (ssize_t) table_len &&
+         pwrite(fd, entries.data(), table_len,
+                backup.entries_lba * GPT_LBA_SIZE) == (ssize_t) table_len &&
+         pwrite(fd, &backup, sizeof(backup), last_lba * GPT_LBA_SIZE) ==
+             (ssize_t) sizeof(backup);
+    close(fd);
+
+    return ok;
+}
+
+#endif  // NV_TESTS_GPT_IMAGE_H_
@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The name index against the linear search it replaced, which went
+ * through the first 256 entries, the most a uint8_t index can reach.
+ */
+
+#include "gpt/gpttegra.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "gpt_image.h"
+
+#define PART_SIZE (64 * 1024)
+
+namespace {
+
+class TestGPT : public GPTDataTegra {
+ public:
+    bool LinearMatch(const std::string& part_name, uint8_t* index) {
+        for (uint32_t i = 0; i < numParts && i < 256; i++) {
+            if (partitions[i].IsUsed() &&
+                part_name.compare(partitions[i].GetDescription()) == 0) {
+                *index = i;
+                return true;
+            }
+        }
+
+        *index = 0;
+        return false;
+    }
+};
+
+class GptTegraTest : public ::testing::Test {
+ protected:
+    // Loads a GPT of num_entries entries holding names, one partition each
+    bool Load(const std::vector<std::string>& names, uint32_t num_entries) {
+        std::vector<GptPartition> parts;
+
+        for (size_t i = 0; i < names.size(); i++)
+            parts.push_back({ names[i], i * PART_SIZE, PART_SIZE });
+        if (!WriteGptImage(file_.path, (names.size() + 1) * PART_SIZE, parts,
+                           num_entries))
+            return false;
+
+        gpt_.SetDisk(file_.path);
+        return gpt_.LoadTegraPartitionIndex();
+    }
+
+    // MatchPartition finds what the linear search does, at the same index
+    void ExpectSameMatch(const std::string& name) {
+        uint8_t index, expected;
+        bool found = gpt_.LinearMatch(name, &expected);
+
+        EXPECT_EQ(gpt_.MatchPartition(name, &index), found) << name;
+        EXPECT_EQ(index, expected) << name;
+        if (found) {
+            EXPECT_EQ(gpt_.GetOffset(index), expected * PART_SIZE) << name;
+            EXPECT_EQ(gpt_.GetSize(index), (uint64_t) PART_SIZE) << name;
+        }
+    }
+
+    TemporaryFile file_;
+    TestGPT gpt_;
+};
+
+}  // namespace
+
+TEST_F(GptTegraTest, Match) {
+    std::vector<std::string> names = { "BCT", "mb1", "mb1_b", "bpmp-fw" };
+
+    ASSERT_TRUE(Load(names, 128));
+    for (const std::string& name : names)
+        ExpectSameMatch(name);
+    ExpectSameMatch("mb2");
+    ExpectSameMatch("");
+}
+
+// The first of duplicate names wins
+TEST_F(GptTegraTest, DuplicateName) {
+    uint8_t index;
+
+    ASSERT_TRUE(Load({ "BCT", "mb1", "cpu-bootloader", "mb1" }, 128));
+    ExpectSameMatch("mb1");
+    ASSERT_TRUE(gpt_.MatchPartition("mb1", &index));
+    EXPECT_EQ(index, 1);
+}
+
+// Entries past the first 256 cannot be indexed, nor were they found
+TEST_F(GptTegraTest, MoreThan256Entries) {
+    std::vector<std::string> names;
+    uint8_t index;
+
+    for (int i = 0; i < 300; i++)
+        names.push_back("part" + std::to_string(i));
+    names[280] = "part3";
+
+    ASSERT_TRUE(Load(names, 320));
+    for (const std::string& name : names)
+        ExpectSameMatch(name);
+
+    ASSERT_TRUE(gpt_.MatchPartition("part255", &index));
+    EXPECT_EQ(index, 255);
+    EXPECT_FALSE(gpt_.MatchPartition("part256", &index));
+    ASSERT_TRUE(gpt_.MatchPartition("part3", &index));
+    EXPECT_EQ(index, 3);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Both engines, io_uring where the kernel allows it and the thread pool,
+ * on the same requests. Where io_uring is not available both runs use the
+ * thread pool.
+ */
+
+#include "io_engine.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <errno.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define KIB 1024
+#define BLOCK (4 * KIB)
+#define BLOCKS 16
+#define DEPTH 3
+
+namespace {
+
+class IoEngineTest : public ::testing::TestWithParam<bool> {
+ protected:
+    void SetUp() override {
+        for (int i = 0; i < BLOCKS * BLOCK; i++)
+            contents_.push_back('a' + i % 26);
+        ASSERT_TRUE(android::base::WriteStringToFile(contents_, file_.path));
+
+        engine_ = IoEngine::Create(DEPTH, GetParam());
+        ASSERT_NE(engine_, nullptr);
+        ASSERT_EQ(engine_->depth(), (size_t) DEPTH);
+    }
+
+    /*
+     * Writes of the even blocks and reads of the odd ones, more than the
+     * engine has in flight at once
+     */
+    void AddMixed() {
+        for (int i = 0; i < BLOCKS; i++) {
+            bool write = i % 2 == 0;
+
+            bufs_.emplace_back(BLOCK, write ? 'A' + i : 0);
+            Add(BLOCK, i * BLOCK, write);
+        }
+    }
+
+    void Add(size_t len, uint64_t offset, bool write) {
+        if (bufs_.size() == reqs_.size())
+            bufs_.emplace_back(len, 0);
+
+        IoRequest req = {};
+        req.fd = file_.fd;
+        req.len = len;
+        req.offset = offset;
+        req.write = write;
+        reqs_.push_back(req);
+    }
+
+    bool Run() {
+        for (size_t i = 0; i < reqs_.size(); i++)
+            reqs_[i].data = bufs_[i].data();
+        return engine_->Run(reqs_.data(), reqs_.size());
+    }
+
+    // Checks what the mixed requests read and wrote
+    void ExpectMixed() {
+        std::string data;
+
+        ASSERT_TRUE(android::base::ReadFileToString(file_.path, &data));
+        for (int i = 0; i < BLOCKS; i++) {
+            std::string block(bufs_[i].begin(), bufs_[i].end());
+
+            EXPECT_EQ(reqs_[i].result, BLOCK) << i;
+            if (reqs_[i].write)
+                EXPECT_EQ(data.substr(i * BLOCK, BLOCK), block) << i;
+            else
+                EXPECT_EQ(block, contents_.substr(i * BLOCK, BLOCK)) << i;
+        }
+    }
+
+    TemporaryFile file_;
+    std::string contents_;
+    std::unique_ptr<IoEngine> engine_;
+    std::vector<IoRequest> reqs_;
+    std::vector<std::vector<char>> bufs_;
+};
+
+}  // namespace
+
+TEST_P(IoEngineTest, Mixed) {
+    AddMixed();
+    ASSERT_TRUE(Run());
+    EXPECT_EQ(engine_->in_flight(), 0u);
+    ExpectMixed();
+}
+
+// A read past the end of the file transfers what there is and fails Run
+TEST_P(IoEngineTest, ShortReadAtEnd) {
+    AddMixed();
+    Add(2 * BLOCK, (BLOCKS - 1) * BLOCK + KIB, false);
+
+    EXPECT_FALSE(Run());
+    EXPECT_EQ(errno, EIO);
+    EXPECT_EQ(engine_->in_flight(), 0u);
+    ExpectMixed();
+
+    // The last block is only read, so the requests may run in any order
+    const IoRequest& last = reqs_.back();
+    std::string tail(bufs_.back().begin(), bufs_.back().begin() + BLOCK - KIB);
+
+    EXPECT_EQ(last.result, BLOCK - KIB);
+    EXPECT_EQ(tail, contents_.substr(BLOCKS * BLOCK - BLOCK + KIB));
+}
+
+// Requests are reaped one by one, each where it was submitted
+TEST_P(IoEngineTest, SubmitReap) {
+    std::vector<char> buf(BLOCK);
+    IoRequest reqs[DEPTH] = {};
+
+    for (int i = 0; i < DEPTH; i++) {
+        reqs[i].fd = file_.fd;
+        reqs[i].data = buf.data();
+        reqs[i].len = KIB;
+        reqs[i].offset = i * BLOCK;
+        ASSERT_TRUE(engine_->Submit(&reqs[i]));
+    }
+    EXPECT_TRUE(engine_->full());
+
+    for (int i = 0; i < DEPTH; i++) {
+        IoRequest* req = engine_->Reap();
+
+        ASSERT_NE(req, nullptr);
+        EXPECT_GE(req, reqs);
+        EXPECT_LT(req, reqs + DEPTH);
+        EXPECT_EQ(req->result, KIB);
+    }
+    EXPECT_EQ(engine_->Reap(), nullptr);
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, IoEngineTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                             return info.param ? "Uring" : "ThreadPool";
+                         });
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Writers on a temporary file. File systems that refuse O_DIRECT, like
+ * tmpfs, skip the tests of the direct path.
+ */
+
+#include "partition_writer.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define KIB 1024
+#define CHUNK (64 * KIB)
+#define FILE_SIZE (8 * CHUNK)
+
+namespace {
+
+std::vector<char> Pattern(size_t size, uint32_t seed) {
+    std::vector<char> data(size);
+
+    for (size_t i = 0; i < size; i++) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (seed >> 16) | 1;
+    }
+    return data;
+}
+
+/*
+ * Completes the first write queued to it with EINVAL, like file systems
+ * that take O_DIRECT at open but not the alignment of the writes, and
+ * does the others.
+ */
+class EinvalEngine : public IoEngine {
+ public:
+    EinvalEngine() : IoEngine(2) {}
+
+    const char* name() const override { return "einval"; }
+
+ protected:
+    bool Start(IoRequest* req) override {
+        if (req->write && !failed_) {
+            req->result = -EINVAL;
+            failed_ = true;
+        } else {
+            req->result = pwrite(req->fd, req->data, req->len, req->offset);
+            if (req->result < 0)
+                req->result = -errno;
+        }
+        queue_.push_back(req);
+        return true;
+    }
+
+    IoRequest* Complete() override {
+        IoRequest* req = queue_.front();
+
+        queue_.erase(queue_.begin());
+        return req;
+    }
+
+ private:
+    std::vector<IoRequest*> queue_;
+    bool failed_ = false;
+};
+
+class PartitionWriterTest : public ::testing::Test {
+ protected:
+    PartitionWriterTest() : pool_(CHUNK) {}
+
+    void SetUp() override {
+        ASSERT_TRUE(android::base::WriteStringToFile(std::string(FILE_SIZE, 'x'),
+                                                     file_.path));
+    }
+
+    std::string Contents() {
+        std::string data;
+
+        EXPECT_TRUE(android::base::ReadFileToString(file_.path, &data));
+        return data;
+    }
+
+    // Writes data at offset in pieces of piece bytes
+    void WriteAt(PartitionWriter* writer, uint64_t offset,
+                 const std::vector<char>& data, size_t piece) {
+        for (size_t done = 0; done < data.size(); done += piece) {
+            ASSERT_TRUE(writer->Write(data.data() + done,
+                                      std::min(piece, data.size() - done)));
+        }
+    }
+
+    // What the file is expected to hold after data was written at offset
+    std::string Expected(uint64_t offset, const std::vector<char>& data) {
+        std::string expected(FILE_SIZE, 'x');
+
+        expected.replace(offset, data.size(), data.data(), data.size());
+        return expected;
+    }
+
+    TemporaryFile file_;
+    AlignedBufferPool pool_;
+};
+
+}  // namespace
+
+// The head and tail around the aligned chunks go through the page cache
+TEST_F(PartitionWriterTest, UnalignedOffsetAndLength) {
+    PartitionWriter writer(&pool_);
+    std::vector<char> data = Pattern(3 * CHUNK + 1234, 1);
+    uint64_t offset = DIRECT_IO_ALIGN + 517;
+
+    ASSERT_TRUE(writer.Open(file_.path, offset, true));
+    if (!writer.direct())
+        GTEST_SKIP() << "no O_DIRECT on " << file_.path;
+
+    WriteAt(&writer, offset, data, 1000);
+    ASSERT_TRUE(writer.Flush());
+    writer.Close();
+
+    EXPECT_EQ(Contents(), Expected(offset, data));
+}
+
+TEST_F(PartitionWriterTest, UnalignedWithEngine) {
+    std::unique_ptr<IoEngine> engine = IoEngine::Create(2, false);
+    PartitionWriter writer(&pool_, engine.get());
+    std::vector<char> data = Pattern(5 * CHUNK - 100, 2);
+    uint64_t offset = 3;
+
+    ASSERT_TRUE(writer.Open(file_.path, offset, true));
+    writer.EnableReadback(2);
+    WriteAt(&writer, offset, data, CHUNK / 3);
+    ASSERT_TRUE(writer.Flush());
+    writer.Close();
+
+    EXPECT_EQ(Contents(), Expected(offset, data));
+}
+
+// A write refused with EINVAL on completion is done buffered instead
+TEST_F(PartitionWriterTest, DropDirectOnCompletion) {
+    EinvalEngine engine;
+    PartitionWriter writer(&pool_, &engine);
+    std::vector<char> data = Pattern(3 * CHUNK, 3);
+
+    ASSERT_TRUE(writer.Open(file_.path, 0, true));
+    if (!writer.direct())
+        GTEST_SKIP() << "no O_DIRECT on " << file_.path;
+
+    WriteAt(&writer, 0, data, CHUNK);
+    ASSERT_TRUE(writer.Flush());
+    EXPECT_FALSE(writer.direct());
+    writer.Close();
+
+    EXPECT_EQ(Contents(), Expected(0, data));
+}
+
+// Zero chunks are left out of the writes, and read back as zeros
+TEST_F(PartitionWriterTest, ZeroChunks) {
+    PartitionWriter writer(&pool_);
+    std::vector<char> data = Pattern(CHUNK, 4);
+    std::vector<char> zeros(3 * CHUNK, 0);
+
+    // The payload ends in zeros
+    data.insert(data.end(), zeros.begin(), zeros.end());
+    data.resize(data.size() + 100, 0);
+
+    ASSERT_TRUE(writer.Open(file_.path, 0, true));
+    if (!writer.direct())
+        GTEST_SKIP() << "no O_DIRECT on " << file_.path;
+    writer.EnableZeroElision();
+
+    WriteAt(&writer, 0, data, CHUNK);
+    ASSERT_TRUE(writer.Flush());
+    writer.Close();
+
+    // The 100 bytes of the tail are written like any other
+    EXPECT_EQ(writer.zeroed(), 3u * CHUNK);
+    EXPECT_EQ(Contents(), Expected(0, data));
+}
+
+// A range that is a hole already is not punched again
+TEST_F(PartitionWriterTest, ZeroChunksOverHole) {
+    PartitionWriter writer(&pool_);
+    std::vector<char> data(FILE_SIZE, 0);
+
+    ASSERT_EQ(truncate(file_.path, 0), 0);
+    ASSERT_EQ(truncate(file_.path, FILE_SIZE), 0);
+
+    ASSERT_TRUE(writer.Open(file_.path, 0, true));
+    if (!writer.direct())
+        GTEST_SKIP() << "no O_DIRECT on " << file_.path;
+    writer.EnableZeroElision();
+
+    WriteAt(&writer, 0, data, CHUNK);
+    ASSERT_TRUE(writer.Flush());
+    writer.Close();
+
+    EXPECT_EQ(writer.zeroed(), (uint64_t) FILE_SIZE);
+    EXPECT_EQ(Contents(), std::string(FILE_SIZE, '\0'));
+}
+
+// Readback of other data than was written fails the flush
+TEST_F(PartitionWriterTest, ReadbackMismatch) {
+    TemporaryFile other;
+    DeviceFiles files;
+    PartitionWriter writer(&pool_);
+    std::vector<char> data = Pattern(2 * CHUNK, 5);
+
+    ASSERT_TRUE(android::base::WriteStringToFile(std::string(FILE_SIZE, 'y'),
+                                                 other.path));
+    ASSERT_TRUE(files.Open(file_.path, true));
+    if (!files.direct || files.verify_fd < 0)
+        GTEST_SKIP() << "no O_DIRECT on " << file_.path;
+
+    // What is read back comes from the other file
+    close(files.verify_fd);
+    files.verify_fd = open(other.path, O_RDONLY | O_DIRECT | O_CLOEXEC);
+    ASSERT_GE(files.verify_fd, 0);
+
+    ASSERT_TRUE(writer.Open(&files, 0));
+    writer.EnableReadback(2);
+    for (size_t done = 0; done < data.size(); done += CHUNK) {
+        if (!writer.Write(data.data() + done, CHUNK))
+            break;
+    }
+    EXPECT_FALSE(writer.Flush());
+    EXPECT_EQ(errno, EIO);
+}
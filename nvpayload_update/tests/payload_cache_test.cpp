@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "payload_cache.h"
+
+#include <gtest/gtest.h>
+#include <openssl/sha.h>
+
+#include <memory>
+#include <vector>
+
+#define KIB 1024
+
+namespace {
+
+PayloadCache::Data Payload(size_t size, char fill) {
+    return std::make_shared<const std::vector<char>>(size, fill);
+}
+
+struct Digest {
+    explicit Digest(uint8_t seed) {
+        for (int i = 0; i < SHA256_DIGEST_LENGTH; i++)
+            bytes[i] = seed + i;
+    }
+
+    uint8_t bytes[SHA256_DIGEST_LENGTH];
+};
+
+}  // namespace
+
+TEST(PayloadCacheTest, FindByRange) {
+    PayloadCache cache(64 * KIB);
+    PayloadCache::Data data = Payload(4 * KIB, 'a');
+
+    EXPECT_EQ(cache.Find(0, 4 * KIB, nullptr), nullptr);
+    cache.Put(0, 4 * KIB, nullptr, data);
+
+    EXPECT_EQ(cache.Find(0, 4 * KIB, nullptr), data);
+    EXPECT_EQ(cache.Find(0, 2 * KIB, nullptr), nullptr);
+    EXPECT_EQ(cache.Find(KIB, 4 * KIB, nullptr), nullptr);
+    EXPECT_EQ(cache.hits(), 1u);
+    EXPECT_EQ(cache.saved_bytes(), 4 * KIB);
+}
+
+// Entries with the same image at other ranges share it
+TEST(PayloadCacheTest, FindByDigest) {
+    PayloadCache cache(64 * KIB);
+    PayloadCache::Data data = Payload(4 * KIB, 'a');
+    Digest digest(1), other(2);
+
+    cache.Put(0, 2 * KIB, digest.bytes, data);
+
+    EXPECT_EQ(cache.Find(8 * KIB, 2 * KIB, digest.bytes), data);
+    EXPECT_EQ(cache.Find(8 * KIB, 2 * KIB, other.bytes), nullptr);
+    // Without a digest only the range counts
+    EXPECT_EQ(cache.Find(8 * KIB, 2 * KIB, nullptr), nullptr);
+}
+
+TEST(PayloadCacheTest, UncheckedNotByDigest) {
+    PayloadCache cache(64 * KIB);
+    Digest digest(1);
+
+    cache.Put(0, 2 * KIB, nullptr, Payload(4 * KIB, 'a'));
+    EXPECT_EQ(cache.Find(8 * KIB, 2 * KIB, digest.bytes), nullptr);
+}
+
+// The least recently used payload goes first
+TEST(PayloadCacheTest, Evict) {
+    PayloadCache cache(12 * KIB);
+    PayloadCache::Data a = Payload(4 * KIB, 'a');
+    PayloadCache::Data b = Payload(4 * KIB, 'b');
+    PayloadCache::Data c = Payload(4 * KIB, 'c');
+
+    cache.Put(0, KIB, nullptr, a);
+    cache.Put(KIB, KIB, nullptr, b);
+    cache.Put(2 * KIB, KIB, nullptr, c);
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), a);
+
+    cache.Put(3 * KIB, KIB, nullptr, Payload(4 * KIB, 'd'));
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), a);
+    EXPECT_EQ(cache.Find(KIB, KIB, nullptr), nullptr);
+    EXPECT_EQ(cache.Find(2 * KIB, KIB, nullptr), c);
+
+    // Shrinking the budget evicts too
+    cache.SetBudget(4 * KIB);
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), nullptr);
+    EXPECT_EQ(cache.Find(2 * KIB, KIB, nullptr), c);
+}
+
+// A payload evicted while it is read from stays alive for its reader
+TEST(PayloadCacheTest, EvictInUse) {
+    PayloadCache cache(4 * KIB);
+    PayloadCache::Data reader;
+
+    cache.Put(0, KIB, nullptr, Payload(4 * KIB, 'a'));
+    reader = cache.Find(0, KIB, nullptr);
+    cache.Put(KIB, KIB, nullptr, Payload(4 * KIB, 'b'));
+
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), nullptr);
+    ASSERT_NE(reader, nullptr);
+    EXPECT_EQ(reader->size(), 4u * KIB);
+    EXPECT_EQ(reader->front(), 'a');
+}
+
+TEST(PayloadCacheTest, TooLarge) {
+    PayloadCache cache(4 * KIB);
+
+    EXPECT_FALSE(cache.Fits(0));
+    EXPECT_TRUE(cache.Fits(4 * KIB));
+    EXPECT_FALSE(cache.Fits(4 * KIB + 1));
+
+    cache.Put(0, KIB, nullptr, Payload(2 * KIB, 'a'));
+    cache.Put(KIB, KIB, nullptr, Payload(4 * KIB + 1, 'b'));
+    EXPECT_EQ(cache.Find(KIB, KIB, nullptr), nullptr);
+    // What is cached already is not evicted for it
+    EXPECT_NE(cache.Find(0, KIB, nullptr), nullptr);
+
+    PayloadCache off(0);
+    off.Put(0, KIB, nullptr, Payload(KIB, 'a'));
+    EXPECT_EQ(off.Find(0, KIB, nullptr), nullptr);
+}
+
+TEST(PayloadCacheTest, Erase) {
+    PayloadCache cache(64 * KIB);
+    Digest digest(1);
+
+    cache.Put(0, KIB, digest.bytes, Payload(KIB, 'a'));
+    cache.Put(KIB, KIB, nullptr, Payload(KIB, 'b'));
+    cache.Erase(0, KIB);
+
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), nullptr);
+    EXPECT_EQ(cache.Find(4 * KIB, KIB, digest.bytes), nullptr);
+    EXPECT_NE(cache.Find(KIB, KIB, nullptr), nullptr);
+
+    cache.Clear();
+    EXPECT_EQ(cache.Find(KIB, KIB, nullptr), nullptr);
+}
+
+// Putting a range again replaces its payload
+TEST(PayloadCacheTest, Replace) {
+    PayloadCache cache(8 * KIB);
+    PayloadCache::Data b = Payload(4 * KIB, 'b');
+
+    cache.Put(0, KIB, nullptr, Payload(4 * KIB, 'a'));
+    cache.Put(0, KIB, nullptr, b);
+    cache.Put(KIB, KIB, nullptr, Payload(4 * KIB, 'c'));
+
+    // Only the replacement took up budget
+    EXPECT_EQ(cache.Find(0, KIB, nullptr), b);
+    EXPECT_NE(cache.Find(KIB, KIB, nullptr), nullptr);
+}
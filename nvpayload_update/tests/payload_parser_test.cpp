@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * The header and entry table checks, through PlanDriver, on blobs built
+ * field by field so each test can break exactly one of them.
+ */
+
+#include "nv_bootloader_payload_updater.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "update_blob.h"
+
+namespace {
+
+class PayloadParserTest : public ::testing::Test {
+ protected:
+    UpdaterConfig Config(const std::vector<char>& blob) {
+        UpdaterConfig config;
+
+        EXPECT_TRUE(android::base::WriteStringToFile(
+            std::string(blob.begin(), blob.end()), blob_.path));
+
+        config.blob_path = blob_.path;
+        config.bmp_path = std::string(dir_.path) + "/bmp.blob";
+        config.partition_path = std::string(dir_.path) + "/";
+        config.journal_path.clear();
+        config.target_slot = 1;
+
+        return config;
+    }
+
+    BLStatus Plan(const std::vector<char>& blob) {
+        NvPayloadUpdate updater(Config(blob));
+
+        out_.str("");
+        return updater.PlanDriver(out_);
+    }
+
+    BLStatus Update(const std::vector<char>& blob) {
+        NvPayloadUpdate updater(Config(blob));
+
+        return updater.UpdateDriver();
+    }
+
+    // Creates the slot b partition of name, size bytes of zeros
+    std::string Partition(const std::string& name, size_t size) {
+        std::string path = std::string(dir_.path) + "/" + name + "_b";
+
+        EXPECT_TRUE(android::base::WriteStringToFile(std::string(size, '\0'),
+                                                     path));
+        return path;
+    }
+
+    TemporaryFile blob_;
+    TemporaryDir dir_;
+    std::ostringstream out_;
+};
+
+}  // namespace
+
+TEST_F(PayloadParserTest, Valid) {
+    EXPECT_EQ(Plan(BuildBlob({ "userfw0", "userfw1" })), kSuccess);
+    EXPECT_NE(out_.str().find("\"userfw0\""), std::string::npos);
+    EXPECT_NE(out_.str().find("\"userfw1\""), std::string::npos);
+}
+
+TEST_F(PayloadParserTest, TruncatedHeader) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    blob.resize(HEADER_SIZE - 1);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, UnknownMagic) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    blob[0] = 'X';
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, HeaderLargerThanBlob) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    Put32(blob, HEADER_HEADER_SIZE, blob.size() + 1);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, EntryTableOutsideBlob) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    // So many that their product with the entry length overflows 32 bits
+    Put32(blob, HEADER_ELEMENTS, UINT32_MAX / ENTRY_LEN + 1);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, EntryTableShortRead) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    // The header says the table fits, but the file ends inside it
+    blob.resize(HEADER_SIZE + ENTRY_LEN / 2);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, PayloadOutsideBlob) {
+    std::vector<char> blob = BuildBlob({ "userfw0", "userfw1" });
+    size_t second = HEADER_SIZE + ENTRY_LEN;
+
+    Put32(blob, second + ENTRY_LEN_FIELD, PAYLOAD_LEN + 1);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, PayloadPositionWraps) {
+    std::vector<char> blob = BuildBlob({ "userfw0" });
+
+    // pos + len only fits in 32 bits by wrapping around
+    Put32(blob, HEADER_SIZE + ENTRY_POS, UINT32_MAX - 16);
+    Put32(blob, HEADER_SIZE + ENTRY_LEN_FIELD, 32);
+    EXPECT_EQ(Plan(blob), kBlobOpenFailed);
+}
+
+TEST_F(PayloadParserTest, PayloadFitsPartition) {
+    std::string path = Partition("userfw0", PAYLOAD_LEN);
+    std::string data;
+
+    EXPECT_EQ(Update(BuildBlob({ "userfw0" })), kSuccess);
+    ASSERT_TRUE(android::base::ReadFileToString(path, &data));
+    EXPECT_EQ(data, std::string(PAYLOAD_LEN, 'P'));
+}
+
+// Nothing is written if any payload is larger than its partition
+TEST_F(PayloadParserTest, PayloadLargerThanPartition) {
+    std::string first = Partition("userfw0", PAYLOAD_LEN);
+    std::string second = Partition("userfw1", PAYLOAD_LEN - 1);
+    std::string data;
+
+    EXPECT_EQ(Update(BuildBlob({ "userfw0", "userfw1" })), kBlobOpenFailed);
+    ASSERT_TRUE(android::base::ReadFileToString(first, &data));
+    EXPECT_EQ(data, std::string(PAYLOAD_LEN, '\0'));
+    ASSERT_TRUE(android::base::ReadFileToString(second, &data));
+    EXPECT_EQ(data, std::string(PAYLOAD_LEN - 1, '\0'));
+}
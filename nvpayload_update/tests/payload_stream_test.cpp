@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "payload_stream.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <lz4frame.h>
+#include <openssl/sha.h>
+#include <string.h>
+#include <zstd.h>
+
+#include <string>
+#include <vector>
+
+#define KIB 1024
+#define CHUNK (16 * KIB)
+#define PREFIX 100
+
+namespace {
+
+// SHA-256 of "abc", FIPS 180-2 appendix B.1
+const uint8_t kAbcDigest[SHA256_DIGEST_LENGTH] = {
+    0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41, 0x40, 0xde,
+    0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3, 0x96, 0x17, 0x7a, 0x9c,
+    0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00, 0x15, 0xad,
+};
+
+std::string Payload(size_t size) {
+    std::string data;
+
+    for (size_t i = 0; i < size; i++)
+        data.push_back(i % 251 < 128 ? 'a' + i % 7 : i % 251);
+    return data;
+}
+
+std::string Compress(const std::string& data, PayloadCodec codec) {
+    std::string frame;
+    size_t len;
+
+    switch (codec) {
+    case kCodecZstd:
+        frame.resize(ZSTD_compressBound(data.size()));
+        len = ZSTD_compress(&frame[0], frame.size(), data.data(), data.size(), 3);
+        if (ZSTD_isError(len))
+            return "";
+        break;
+    case kCodecLz4: {
+        LZ4F_preferences_t prefs;
+
+        memset(&prefs, 0, sizeof(prefs));
+        prefs.frameInfo.contentSize = data.size();
+        frame.resize(LZ4F_compressFrameBound(data.size(), &prefs));
+        len = LZ4F_compressFrame(&frame[0], frame.size(), data.data(),
+                                 data.size(), &prefs);
+        if (LZ4F_isError(len))
+            return "";
+        break;
+    }
+    default:
+        return data;
+    }
+
+    frame.resize(len);
+    return frame;
+}
+
+class PayloadStreamTest : public ::testing::TestWithParam<PayloadCodec> {
+ protected:
+    /*
+     * Streams data stored with the codec of the test at an offset into the
+     * blob, and checks it and the digest, asked for twice
+     */
+    void StreamAndDigest(const std::string& data,
+                         const uint8_t expected[SHA256_DIGEST_LENGTH]) {
+        std::string frame = Compress(data, GetParam());
+        PayloadCodec codec;
+        uint64_t size;
+        uint8_t digest[SHA256_DIGEST_LENGTH], again[SHA256_DIGEST_LENGTH];
+        std::string streamed;
+        const char* chunk;
+        ssize_t len;
+
+        ASSERT_FALSE(frame.empty());
+        ASSERT_TRUE(android::base::WriteStringToFile(
+                std::string(PREFIX, 'p') + frame + "trailer", file_.path));
+
+        ASSERT_TRUE(ProbePayload(file_.fd, PREFIX, frame.size(), &codec, &size));
+        ASSERT_EQ(codec, GetParam());
+        if (codec == kCodecNone)
+            size = frame.size();
+        ASSERT_EQ(size, data.size());
+
+        PayloadStream stream(file_.fd, PREFIX, frame.size(), codec, size, CHUNK);
+        stream.EnableDigest();
+        while ((len = stream.Next(&chunk)) > 0)
+            streamed.append(chunk, len);
+        ASSERT_EQ(len, 0);
+        EXPECT_TRUE(streamed == data);
+
+        ASSERT_TRUE(stream.Digest(digest));
+        ASSERT_TRUE(stream.Digest(again));
+        EXPECT_EQ(memcmp(digest, expected, sizeof(digest)), 0);
+        EXPECT_EQ(memcmp(again, expected, sizeof(again)), 0);
+    }
+
+    TemporaryFile file_;
+};
+
+}  // namespace
+
+TEST_P(PayloadStreamTest, KnownDigest) {
+    StreamAndDigest("abc", kAbcDigest);
+}
+
+// More chunks than the stream holds at once
+TEST_P(PayloadStreamTest, DigestOverChunks) {
+    std::string data = Payload(10 * CHUNK + 321);
+    uint8_t expected[SHA256_DIGEST_LENGTH];
+
+    SHA256((const uint8_t*) data.data(), data.size(), expected);
+    StreamAndDigest(data, expected);
+}
+
+TEST_P(PayloadStreamTest, NoDigest) {
+    std::string frame = Compress("abc", GetParam());
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    const char* chunk;
+
+    ASSERT_TRUE(android::base::WriteStringToFile(frame, file_.path));
+
+    PayloadStream stream(file_.fd, 0, frame.size(), GetParam(), 3, CHUNK);
+    EXPECT_EQ(stream.Next(&chunk), 3);
+    EXPECT_EQ(stream.Next(&chunk), 0);
+    EXPECT_FALSE(stream.Digest(digest));
+}
+
+INSTANTIATE_TEST_SUITE_P(Codecs, PayloadStreamTest,
+                         ::testing::Values(kCodecNone, kCodecZstd, kCodecLz4),
+                         [](const ::testing::TestParamInfo<PayloadCodec>& info) {
+                             return std::string(PayloadCodecName(info.param));
+                         });
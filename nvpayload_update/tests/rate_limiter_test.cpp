@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * A limiter starts with empty buckets, so the first write waits for all
+ * of its tokens: len / rate, less whatever trickled in since it was made.
+ */
+
+#include "rate_limiter.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include "update_report.h"
+
+#define MIB (1024 * 1024)
+#define RATE (10 * MIB)
+
+namespace {
+
+// Expects the wait for len bytes at rate, give or take the refill
+void ExpectWaited(const RateLimiter& limiter, double len, double rate) {
+    double expected = len * 1e6 / rate;
+
+    EXPECT_LE(limiter.waited_us(), expected + 1);
+    EXPECT_GE(limiter.waited_us(), expected * 0.8);
+}
+
+}  // namespace
+
+TEST(RateLimiterTest, Unlimited) {
+    RateLimiter limiter((RateLimit()));
+
+    for (int i = 0; i < 100; i++)
+        limiter.Acquire(MIB);
+    EXPECT_EQ(limiter.waited_us(), 0u);
+    EXPECT_FALSE(limiter.adaptive());
+}
+
+TEST(RateLimiterTest, Bytes) {
+    RateLimit limit;
+    uint64_t start = NowUs();
+
+    limit.bytes_per_sec = RATE;
+    RateLimiter limiter(limit);
+    for (int i = 0; i < 4; i++)
+        limiter.Acquire(MIB / 2);
+
+    ExpectWaited(limiter, 2 * MIB, RATE);
+    EXPECT_GE(NowUs() - start, limiter.waited_us());
+}
+
+// A write larger than the bucket still goes through, at the rate
+TEST(RateLimiterTest, LargerThanBurst) {
+    RateLimit limit;
+
+    limit.bytes_per_sec = RATE;
+    RateLimiter limiter(limit);
+    limiter.Acquire(3 * MIB);
+
+    ExpectWaited(limiter, 3 * MIB, RATE);
+}
+
+TEST(RateLimiterTest, Ops) {
+    RateLimit limit;
+
+    limit.ops_per_sec = 200;
+    RateLimiter limiter(limit);
+    for (int i = 0; i < 40; i++)
+        limiter.Acquire(1);
+
+    ExpectWaited(limiter, 40, 200);
+}
+
+// Slow writes within one interval cut the rate by a quarter only once
+TEST(RateLimiterTest, LatencyCut) {
+    RateLimit limit;
+
+    limit.bytes_per_sec = RATE;
+    limit.latency_us = 1000;
+    RateLimiter limiter(limit);
+    ASSERT_TRUE(limiter.adaptive());
+
+    limiter.Observe(5000);
+    limiter.Observe(5000);
+    limiter.Acquire(MIB);
+
+    ExpectWaited(limiter, MIB, RATE * 3 / 4);
+}
+
+// Fast writes bring the rate back, but not beyond the configured one
+TEST(RateLimiterTest, LatencyRecover) {
+    RateLimit limit;
+
+    limit.bytes_per_sec = RATE;
+    limit.latency_us = 1000;
+    RateLimiter limiter(limit);
+
+    limiter.Observe(5000);
+    for (int i = 0; i < 20; i++)
+        limiter.Observe(100);
+    limiter.Acquire(MIB);
+
+    ExpectWaited(limiter, MIB, RATE);
+}
+
+// Without a latency target, completions change nothing
+TEST(RateLimiterTest, NotAdaptive) {
+    RateLimit limit;
+
+    limit.bytes_per_sec = RATE;
+    RateLimiter limiter(limit);
+
+    limiter.Observe(1000000);
+    limiter.Acquire(MIB);
+
+    ExpectWaited(limiter, MIB, RATE);
+}
+
+TEST(RateLimiterTest, DeviceOf) {
+    TemporaryDir dir;
+    std::string a = std::string(dir.path) + "/a";
+    std::string b = std::string(dir.path) + "/b";
+
+    ASSERT_TRUE(android::base::WriteStringToFile("a", a));
+    ASSERT_TRUE(android::base::WriteStringToFile("b", b));
+
+    // Partitions of the same disk share one limiter
+    EXPECT_FALSE(RateLimiter::DeviceOf(a).empty());
+    EXPECT_EQ(RateLimiter::DeviceOf(a), RateLimiter::DeviceOf(b));
+}
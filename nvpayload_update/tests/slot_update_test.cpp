@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Updates of the boot device partitions of one slot or of both, on a
+ * file-backed boot device whose partitions start out filled with 'R'.
+ */
+
+#include "nv_bootloader_payload_updater.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "gpt_image.h"
+#include "update_blob.h"
+
+#define PART_SIZE (64 * 1024)
+#define EMMC_GEOMETRY "logical_block_size=512\nphysical_block_size=512\n" \
+                      "minimum_io_size=512\noptimal_io_size=0\n"
+
+namespace {
+
+class SlotUpdateTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        std::vector<GptPartition> parts;
+        std::string dir(dir_.path);
+
+        for (const char* name : { "BCT", "mb1", "mb1_b" })
+            parts.push_back({ name, parts.size() * PART_SIZE, PART_SIZE });
+        disk_size_ = (parts.size() + 1) * PART_SIZE;
+
+        config_.blob_path = dir + "/bl_update_payload";
+        config_.bmp_path = dir + "/bmp.blob";
+        config_.partition_path = dir + "/";
+        config_.boot_part = dir + "/bootdev";
+        config_.gpt_part = dir + "/gptdev";
+        config_.geometry_path = dir + "/geometry";
+        config_.journal_path.clear();
+        config_.verify_journal_path = dir + "/verify.journal";
+
+        std::vector<char> blob = BuildBlob({ "mb1" });
+
+        ASSERT_TRUE(WriteGptImage(config_.gpt_part, disk_size_, parts));
+        ASSERT_TRUE(android::base::WriteStringToFile(std::string(disk_size_, 'R'),
+                                                     config_.boot_part));
+        ASSERT_TRUE(android::base::WriteStringToFile(EMMC_GEOMETRY,
+                                                     config_.geometry_path));
+        ASSERT_TRUE(android::base::WriteStringToFile(
+                std::string(blob.begin(), blob.end()), config_.blob_path));
+    }
+
+    // The boot device partition at index of the GPT
+    std::string BootPartition(int index) {
+        std::string data;
+
+        EXPECT_TRUE(android::base::ReadFileToString(config_.boot_part, &data));
+        return data.substr(index * PART_SIZE, PART_SIZE);
+    }
+
+    static std::string Updated() {
+        return std::string(PAYLOAD_LEN, 'P') +
+               std::string(PART_SIZE - PAYLOAD_LEN, 'R');
+    }
+
+    TemporaryDir dir_;
+    UpdaterConfig config_;
+    uint64_t disk_size_ = 0;
+};
+
+}  // namespace
+
+// The depend steps of slot 0 land on mb1_b as well, not on the mb1 booted
+TEST_F(SlotUpdateTest, SingleSlotLeavesOtherSlot) {
+    config_.target_slot = 1;
+    NvPayloadUpdate updater(config_);
+
+    ASSERT_EQ(updater.UpdateDriver(), kSuccess);
+    EXPECT_TRUE(BootPartition(1) == std::string(PART_SIZE, 'R'));
+    EXPECT_TRUE(BootPartition(2) == Updated());
+}
+
+TEST_F(SlotUpdateTest, SingleSlotZero) {
+    config_.target_slot = 0;
+    NvPayloadUpdate updater(config_);
+
+    ASSERT_EQ(updater.UpdateDriver(), kSuccess);
+    EXPECT_TRUE(BootPartition(1) == Updated());
+    EXPECT_TRUE(BootPartition(2) == std::string(PART_SIZE, 'R'));
+}
+
+TEST_F(SlotUpdateTest, BothSlots) {
+    config_.both_slots = true;
+    NvPayloadUpdate updater(config_);
+
+    ASSERT_EQ(updater.UpdateDriver(), kSuccess);
+    EXPECT_TRUE(BootPartition(1) == Updated());
+    EXPECT_TRUE(BootPartition(2) == Updated());
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_TESTS_UPDATE_BLOB_H_
+#define NV_TESTS_UPDATE_BLOB_H_
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "nv_bootloader_payload_updater.h"
+
+// Layout of a V2 update blob
+#define HEADER_SIZE (UPDATE_MAGIC_SIZE - 1 + 6 * sizeof(uint32_t) + 8)
+#define ENTRY_LEN (ENTRY_LEN_WO_SPEC + IMG_SPEC_INFO_LENGTH_V2)
+#define PAYLOAD_LEN 4096
+// Offsets of the header fields
+#define HEADER_BLOB_SIZE (UPDATE_MAGIC_SIZE - 1 + 4)
+#define HEADER_HEADER_SIZE (HEADER_BLOB_SIZE + 4)
+#define HEADER_ELEMENTS (HEADER_HEADER_SIZE + 4)
+// Offsets of the fields of an entry
+#define ENTRY_POS PARTITION_LEN
+#define ENTRY_LEN_FIELD (PARTITION_LEN + 4)
+
+inline void Put32(std::vector<char>& blob, size_t offset, uint32_t value) {
+    memcpy(blob.data() + offset, &value, sizeof(value));
+}
+
+// A V2 update blob with one raw entry per name
+inline std::vector<char> BuildBlob(const std::vector<std::string>& names) {
+    size_t table = HEADER_SIZE;
+    size_t data = table + names.size() * ENTRY_LEN;
+    std::vector<char> blob(data + names.size() * PAYLOAD_LEN, 'P');
+
+    memset(blob.data(), 0, data);
+    memcpy(blob.data(), UPDATE_MAGIC_V2, UPDATE_MAGIC_SIZE - 1);
+    Put32(blob, UPDATE_MAGIC_SIZE - 1, 0x00010000);
+    Put32(blob, HEADER_BLOB_SIZE, blob.size());
+    Put32(blob, HEADER_HEADER_SIZE, HEADER_SIZE);
+    Put32(blob, HEADER_ELEMENTS, names.size());
+    Put32(blob, HEADER_ELEMENTS + 4, UPDATE_TYPE);
+    Put32(blob, HEADER_ELEMENTS + 8, 0);
+
+    for (size_t i = 0; i < names.size(); i++) {
+        size_t entry = table + i * ENTRY_LEN;
+
+        memcpy(blob.data() + entry, names[i].c_str(), names[i].size());
+        Put32(blob, entry + ENTRY_POS, data + i * PAYLOAD_LEN);
+        Put32(blob, entry + ENTRY_LEN_FIELD, PAYLOAD_LEN);
+    }
+
+    return blob;
+}
+
+#endif  // NV_TESTS_UPDATE_BLOB_H_
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "update_journal.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace {
+
+class UpdateJournalTest : public ::testing::Test {
+ protected:
+    void SetUp() override {
+        path_ = std::string(dir_.path) + "/journal";
+        for (int i = 0; i < JOURNAL_ID_SIZE; i++)
+            id_[i] = i;
+    }
+
+    off_t FileSize() {
+        struct stat st;
+
+        return stat(path_.c_str(), &st) ? -1 : st.st_size;
+    }
+
+    TemporaryDir dir_;
+    std::string path_;
+    uint8_t id_[JOURNAL_ID_SIZE];
+};
+
+}  // namespace
+
+TEST_F(UpdateJournalTest, Replay) {
+    UpdateJournal journal;
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    ASSERT_TRUE(journal.Checkpoint(0, 1, 4096));
+    ASSERT_TRUE(journal.Complete(0, 1));
+    ASSERT_TRUE(journal.Checkpoint(1, 1, 8192));
+    ASSERT_TRUE(journal.Checkpoint(1, 1, 12288));
+    journal.Close();
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    EXPECT_TRUE(journal.Done(0, 1));
+    EXPECT_EQ(journal.Progress(0, 1), 4096u);
+    EXPECT_FALSE(journal.Done(1, 1));
+    EXPECT_EQ(journal.Progress(1, 1), 12288u);
+    EXPECT_EQ(journal.Progress(2, 1), 0u);
+}
+
+// A record cut short by a power loss is dropped, the ones before it count
+TEST_F(UpdateJournalTest, TornTail) {
+    UpdateJournal journal;
+    off_t end;
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    ASSERT_TRUE(journal.Checkpoint(3, 1, 4096));
+    end = FileSize();
+    ASSERT_TRUE(journal.Checkpoint(3, 1, 8192));
+    journal.Close();
+
+    ASSERT_EQ(truncate(path_.c_str(), FileSize() - 1), 0);
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    EXPECT_EQ(journal.Progress(3, 1), 4096u);
+    EXPECT_EQ(FileSize(), end);
+
+    // Records appended after the trimmed tail are found again
+    ASSERT_TRUE(journal.Complete(3, 1));
+    journal.Close();
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    EXPECT_TRUE(journal.Done(3, 1));
+    EXPECT_EQ(journal.Progress(3, 1), 4096u);
+}
+
+// A whole record that does not check out ends the replay too
+TEST_F(UpdateJournalTest, CorruptTail) {
+    UpdateJournal journal;
+    off_t end;
+    int fd;
+
+    ASSERT_TRUE(journal.Open(path_, 0, id_));
+    ASSERT_TRUE(journal.Checkpoint(0, 0, 512));
+    end = FileSize();
+    ASSERT_TRUE(journal.Checkpoint(0, 0, 1024));
+    journal.Close();
+
+    fd = open(path_.c_str(), O_WRONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(pwrite(fd, "X", 1, end + 8), 1);
+    close(fd);
+
+    ASSERT_TRUE(journal.Open(path_, 0, id_));
+    EXPECT_EQ(journal.Progress(0, 0), 512u);
+    EXPECT_EQ(FileSize(), end);
+}
+
+// A journal of another payload or slot is started over
+TEST_F(UpdateJournalTest, OtherUpdate) {
+    UpdateJournal journal;
+    uint8_t other[JOURNAL_ID_SIZE] = {};
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    ASSERT_TRUE(journal.Complete(0, 1));
+    journal.Close();
+
+    ASSERT_TRUE(journal.Open(path_, 0, id_));
+    EXPECT_FALSE(journal.Done(0, 1));
+    journal.Close();
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    ASSERT_TRUE(journal.Complete(0, 1));
+    journal.Close();
+
+    ASSERT_TRUE(journal.Open(path_, 1, other));
+    EXPECT_FALSE(journal.Done(0, 1));
+}
+
+TEST_F(UpdateJournalTest, Remove) {
+    UpdateJournal journal;
+
+    ASSERT_TRUE(journal.Open(path_, 1, id_));
+    journal.Remove();
+    EXPECT_FALSE(journal.IsOpen());
+    EXPECT_NE(access(path_.c_str(), F_OK), 0);
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "update_journal.h"
+
+#include <android-base/logging.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <string>
+
+#define JOURNAL_MAGIC "NVBUPJNL"
+#define JOURNAL_MAGIC_SIZE 8
+#define JOURNAL_VERSION 1
+
+struct JournalHeader {
+    char magic[JOURNAL_MAGIC_SIZE];
+    uint32_t version;
+    int32_t slot;
+    uint8_t id[JOURNAL_ID_SIZE];
+    uint32_t crc;
+};
+
+struct JournalRecord {
+    uint32_t index;
+    int32_t slot;
+    uint64_t bytes;
+    uint32_t done;
+    uint32_t crc;
+};
+
+template <typename T>
+static uint32_t RecordCrc(const T& record) {
+    return crc32(0, reinterpret_cast<const Bytef*>(&record),
+                 offsetof(T, crc));
+}
+
+static bool WriteFull(int fd, const void* buf, size_t len) {
+    const char* p = static_cast<const char*>(buf);
+
+    while (len) {
+        ssize_t bytes = write(fd, p, len);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return false;
+        p += bytes;
+        len -= bytes;
+    }
+
+    return true;
+}
+
+// Makes a new journal file itself durable, not only its contents
+static void SyncParent(const std::string& path) {
+    std::string dir = path;
+    int fd = open(dirname(&dir[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+UpdateJournal::~UpdateJournal() {
+    Close();
+}
+
+bool UpdateJournal::Open(const std::string& path, int slot,
+                         const uint8_t id[JOURNAL_ID_SIZE]) {
+    JournalHeader header;
+
+    Close();
+    path_ = path;
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd_ < 0) {
+        PLOG(WARNING) << "Could not open journal " << path;
+        return false;
+    }
+
+    if (pread(fd_, &header, sizeof(header), 0) == sizeof(header) &&
+        !memcmp(header.magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) &&
+        header.version == JOURNAL_VERSION && header.slot == slot &&
+        !memcmp(header.id, id, JOURNAL_ID_SIZE) &&
+        header.crc == RecordCrc(header)) {
+        Load();
+        LOG(INFO) << "Resuming update from journal " << path << ", "
+            << states_.size() << " entries recorded";
+        return true;
+    }
+
+    // Not ours, or not a journal: start over
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+    header.version = JOURNAL_VERSION;
+    header.slot = slot;
+    memcpy(header.id, id, JOURNAL_ID_SIZE);
+    header.crc = RecordCrc(header);
+
+    if (ftruncate(fd_, 0) || lseek(fd_, 0, SEEK_SET) ||
+        !WriteFull(fd_, &header, sizeof(header)) || fdatasync(fd_)) {
+        PLOG(WARNING) << "Could not create journal " << path;
+        Close();
+        return false;
+    }
+    SyncParent(path);
+
+    return true;
+}
+
+// Replays the records after the header and drops a torn tail
+void UpdateJournal::Load() {
+    off_t offset = sizeof(JournalHeader);
+    JournalRecord record;
+
+    while (pread(fd_, &record, sizeof(record), offset) == sizeof(record) &&
+           record.crc == RecordCrc(record)) {
+        State& state = states_[{ record.index, record.slot }];
+
+        state.bytes = record.bytes;
+        state.done = record.done;
+        offset += sizeof(record);
+    }
+
+    if (ftruncate(fd_, offset) || lseek(fd_, offset, SEEK_SET) != offset)
+        PLOG(WARNING) << "Could not trim journal " << path_;
+}
+
+bool UpdateJournal::Done(uint32_t index, int slot) const {
+    auto it = states_.find({ index, slot });
+
+    return it != states_.end() && it->second.done;
+}
+
+uint64_t UpdateJournal::Progress(uint32_t index, int slot) const {
+    auto it = states_.find({ index, slot });
+
+    return it != states_.end() ? it->second.bytes : 0;
+}
+
+bool UpdateJournal::Checkpoint(uint32_t index, int slot, uint64_t bytes) {
+    return Append(index, slot, bytes, false);
+}
+
+bool UpdateJournal::Complete(uint32_t index, int slot) {
+    return Append(index, slot, Progress(index, slot), true);
+}
+
+bool UpdateJournal::Append(uint32_t index, int slot, uint64_t bytes,
+                           bool done) {
+    JournalRecord record;
+
+    if (fd_ < 0)
+        return false;
+
+    memset(&record, 0, sizeof(record));
+    record.index = index;
+    record.slot = slot;
+    record.bytes = bytes;
+    record.done = done;
+    record.crc = RecordCrc(record);
+
+    if (!WriteFull(fd_, &record, sizeof(record)) || fdatasync(fd_)) {
+        PLOG(WARNING) << "Could not append to journal " << path_;
+        return false;
+    }
+
+    State& state = states_[{ index, slot }];
+    state.bytes = bytes;
+    state.done = done;
+
+    return true;
+}
+
+void UpdateJournal::Remove() {
+    if (fd_ < 0)
+        return;
+
+    Close();
+    if (unlink(path_.c_str()))
+        PLOG(WARNING) << "Could not remove journal " << path_;
+    else
+        SyncParent(path_);
+}
+
+void UpdateJournal::Close() {
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+    states_.clear();
+}
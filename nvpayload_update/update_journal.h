@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_UPDATE_JOURNAL_H_
+#define NV_UPDATE_JOURNAL_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+
+#define JOURNAL_ID_SIZE 32
+
+/*
+ * Append-only record of update progress, so an update that was cut short
+ * by a reboot or a killed postinstall resumes where it stopped. A journal
+ * belongs to one target slot and one payload; any other journal found at
+ * the path is discarded.
+ *
+ * Progress is recorded per entry table index and slot: the number of
+ * payload bytes known to be on the media, and whether the entry was
+ * written and verified. Records are synced before they count, and a torn
+ * record at the end of the file is ignored.
+ */
+class UpdateJournal {
+ public:
+    ~UpdateJournal();
+
+    // Opens or creates the journal, false if it can not be used
+    bool Open(const std::string& path, int slot,
+              const uint8_t id[JOURNAL_ID_SIZE]);
+    bool IsOpen() const { return fd_ >= 0; }
+
+    bool Done(uint32_t index, int slot) const;
+    // Payload bytes of the entry that are durable on the media
+    uint64_t Progress(uint32_t index, int slot) const;
+
+    // Both return false if the record could not be made durable
+    bool Checkpoint(uint32_t index, int slot, uint64_t bytes);
+    bool Complete(uint32_t index, int slot);
+
+    // Closes and deletes the journal once the update is finished
+    void Remove();
+    void Close();
+
+ private:
+    struct State {
+        uint64_t bytes = 0;
+        bool done = false;
+    };
+
+    bool Append(uint32_t index, int slot, uint64_t bytes, bool done);
+    void Load();
+
+    int fd_ = -1;
+    std::string path_;
+    std::map<std::pair<uint32_t, int>, State> states_;
+};
+
+#endif  // NV_UPDATE_JOURNAL_H_
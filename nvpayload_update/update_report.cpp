@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "update_report.h"
+
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+uint64_t NowUs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void PrintJsonString(std::ostream& out, std::string_view str) {
+    static const char hex[] = "0123456789abcdef";
+
+    out << '"';
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (c < 0x20)
+            out << "\\u00" << hex[c >> 4] << hex[c & 0xf];
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+// CPU time of all threads of the process
+static uint64_t ProcessCpuUs() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+CpuBudget::CpuBudget(unsigned percent)
+    : percent_(percent), cpu_start_(ProcessCpuUs()), wall_start_(NowUs()) {}
+
+void CpuBudget::Throttle() const {
+    if (!percent_ || percent_ >= 100)
+        return;
+
+    uint64_t due = (ProcessCpuUs() - cpu_start_) * 100 / percent_;
+    uint64_t elapsed = NowUs() - wall_start_;
+
+    if (due > elapsed)
+        usleep(due - elapsed);
+}
+
+EntryReport* UpdateReport::Begin(std::string_view partition, int slot,
+                                 const std::string& path) {
+    EntryReport& entry = entries_.emplace_back();
+
+    entry.partition.assign(partition);
+    entry.slot = slot;
+    entry.path = path;
+    return &entry;
+}
+
+void UpdateReport::Skip(std::string_view partition, int slot,
+                        const std::string& path, const char* reason) {
+    Begin(partition, slot, path)->skip_reason = reason;
+}
+
+void UpdateReport::AddSync(uint64_t us) {
+    syncs_++;
+    sync_us_ += us;
+}
+
+void UpdateReport::Start() {
+    entries_.clear();
+    syncs_ = 0;
+    sync_us_ = 0;
+    start_us_ = NowUs();
+}
+
+void UpdateReport::Finish(int status) {
+    total_us_ = NowUs() - start_us_;
+    status_ = status;
+}
+
+// Bytes per microsecond equals MB/s
+static double Throughput(uint64_t bytes, uint64_t us) {
+    return us ? (double) bytes / us : 0;
+}
+
+void UpdateReport::Print(std::ostream& out, bool pretty) const {
+    const char* nl = pretty ? "\n" : "";
+    const char* indent = pretty ? "    " : "";
+    uint64_t total_read = 0;
+    uint64_t total_written = 0;
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    out << "{" << nl << " \"status\": " << status_ << ", \"entries\": [" << nl;
+    for (size_t i = 0; i < entries_.size(); i++) {
+        const EntryReport& e = entries_[i];
+        uint64_t io_us = e.write_us + e.sync_us;
+
+        out << indent << "{ \"partition\": ";
+        PrintJsonString(out, e.partition);
+        out << ", \"slot\": " << e.slot << ", \"path\": ";
+        PrintJsonString(out, e.path);
+        out << ", \"bytes_read\": " << e.bytes_read
+            << ", \"bytes_written\": " << e.bytes_written
+            << ", \"bytes_zeroed\": " << e.bytes_zeroed
+            << ", \"read_us\": " << e.read_us
+            << ", \"write_us\": " << e.write_us
+            << ", \"sync_us\": " << e.sync_us
+            << ", \"verify_us\": " << e.verify_us
+            << ", \"write_mbps\": " << Throughput(e.bytes_written, io_us)
+            << ", \"mismatch\": " << (e.mismatch ? "true" : "false")
+            << ", \"skip_reason\": ";
+        PrintJsonString(out, e.skip_reason);
+        out << " }" << (i + 1 < entries_.size() ? "," : "") << nl;
+
+        total_read += e.bytes_read;
+        total_written += e.bytes_written;
+    }
+
+    out << " ], \"total_bytes_read\": " << total_read
+        << ", \"total_bytes_written\": " << total_written
+        << ", \"syncs\": " << syncs_
+        << ", \"sync_us\": " << sync_us_
+        << ", \"total_us\": " << total_us_
+        << ", \"total_mbps\": " << Throughput(total_written, total_us_)
+        << ", \"peak_rss_kb\": " << usage.ru_maxrss << nl << "}" << nl;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2026 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef NV_UPDATE_REPORT_H_
+#define NV_UPDATE_REPORT_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+// Monotonic time in microseconds
+uint64_t NowUs();
+
+// Prints str as a quoted JSON string
+void PrintJsonString(std::ostream& out, std::string_view str);
+
+struct EntryReport {
+    std::string partition;
+    int slot = 0;
+    std::string path;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    uint64_t bytes_zeroed = 0;  // of bytes_written, zeroed without writing
+    uint64_t read_us = 0;
+    uint64_t write_us = 0;
+    uint64_t sync_us = 0;
+    uint64_t verify_us = 0;
+    bool mismatch = false;      // media found to differ from the payload
+    std::string skip_reason;
+};
+
+// Adds the time from construction to destruction to a counter
+class ScopedTimer {
+ public:
+    explicit ScopedTimer(uint64_t* counter) : counter_(counter), start_(NowUs()) {}
+    ~ScopedTimer() { *counter_ += NowUs() - start_; }
+
+ private:
+    uint64_t* counter_;
+    uint64_t start_;
+};
+
+/*
+ * Keeps the CPU time of the whole process since construction within
+ * percent of the time since then, by sleeping off any excess in
+ * Throttle. 0 or 100 percent is no limit.
+ */
+class CpuBudget {
+ public:
+    explicit CpuBudget(unsigned percent);
+
+    void Throttle() const;
+
+ private:
+    unsigned percent_;
+    uint64_t cpu_start_;
+    uint64_t wall_start_;
+};
+
+/*
+ * Per-partition timings of one updater run, printed as JSON so update
+ * duration can be trended across releases.
+ */
+class UpdateReport {
+ public:
+    // Starts the record of one entry. The pointer stays valid.
+    EntryReport* Begin(std::string_view partition, int slot,
+                       const std::string& path);
+    void Skip(std::string_view partition, int slot, const std::string& path,
+              const char* reason);
+    // Accounts a sync that made the writes of several entries durable
+    void AddSync(uint64_t us);
+
+    void Start();
+    void Finish(int status);
+
+    void Print(std::ostream& out, bool pretty) const;
+
+ private:
+    // deque keeps handed out pointers valid
+    std::deque<EntryReport> entries_;
+    uint64_t start_us_ = 0;
+    uint64_t total_us_ = 0;
+    uint64_t syncs_ = 0;
+    uint64_t sync_us_ = 0;
+    int status_ = 0;
+};
+
+#endif  // NV_UPDATE_REPORT_H_